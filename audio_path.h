@@ -0,0 +1,227 @@
+//////////////////////////////////////////////////////////////////////
+// The audio buffers and dma_handler, the whole of the audio path
+//
+// This was the middle of i2s_example.cpp.  It is here so the same ISR runs
+// on the board and in tools/pipeline_host, the only difference being the
+// backend behind hal.h.  The configuration (ISR_BLOCK, MIX_MODE, NET_RX,
+// ADC_DECIMATE, FLOW_DEVICES, LATENCY and LATENCY_PATH) is defined by the
+// file that includes this.  pipeline_start() is the set up of the network
+// side that both mains share.
+//
+
+#pragma once
+#include <stdint.h>
+#include "hal.h"
+#include "histogram.hpp"
+#include "upsample.h"
+#include "decimate.h"
+#include "mixer.h"
+#include "biquad.h"
+#include "meter.h"
+#include "deadline.h"
+#include "latency.h"
+#include "deinterleave.h"
+#include "rtp_tx.h"
+#include "flows.h"
+#include "telemetry.h"
+#include "dante_snoop.h"
+
+using namespace DAES67;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Memory placement for the audio path
+//
+// Everything the ISR runs is in RAM (__not_in_flash_func), so it never waits on an XIP cache miss, and it
+// can keep running while flash is being written.  The SRAM banks are used so the bus masters stay apart:
+//
+//   scratch X   the DMA double buffers audio_int, audio_out and audio_adc, beside the core 1 stack
+//   scratch Y   the core 0 stack, the FIR state audio_buf and the deinterleave table, only core 0 touches these
+//   striped     the code, the other buffers and everything else, where contention is spread over four banks
+//
+// Scratch Y is 4k.  The FIR state and the table take 1.75k with ISR_BLOCK of 4, and the top 2k is the stack,
+// which the ISR shares with main() and udp_test().  The stack would run down over the table and the FIR state
+// once it passed 2k, so the large buffers of those loops are static, PICO_USE_STACK_GUARDS makes an overflow
+// fault, and stack_spare() on the core 1 page shows how much of the 2k has never been used.
+// isr_worst[] keeps the longest ISR seen, normally and while flash is busy, using only the timer register,
+// as the histograms are in flash and are skipped while it is being written.
+//
+int32_t   audio_i2s[1][2][ISR_BLOCK][2] __attribute__((aligned(2*2*ISR_BLOCK*4))) = { };    // Single line of normal rate I2S
+int32_t   audio_tdm[1][2][ISR_BLOCK][8] __attribute__((aligned(2*8*ISR_BLOCK*4))) = { };    // One 8 ch TDM injest
+int32_t   audio_out[4][2][ISR_BLOCK][4] __scratch_x("audio") __attribute__((aligned(2*4*ISR_BLOCK*4))) = { };    // Outut four lines of double rate I2S
+int32_t   audio_int[1][2][ISR_BLOCK][8] __scratch_x("audio") __attribute__((aligned(2*8*ISR_BLOCK*4))) = { };    // Interleaved I2S from the i2s_four_in
+int32_t   audio_buf[8][ISR_BLOCK+FILTER2X_TAPS-1] __scratch_y("audio") = { };              // 8 channels of FIR buffer
+int32_t   audio_mix[ISR_BLOCK][8] = { };                                                    // Output of the routing matrix
+Mixer     mixer;                                                                            // Gains posted by the non-audio core
+Eq        eq;                                                                               // Per channel EQ sections, flat until posted
+Meter     meter;                                                                            // Levels and clips, read by core1
+Deadline  deadline;                                                                         // ISR headroom against the DMA, read by core1
+Latency   latency;                                                                          // Marker and capture for the round trip, searched by the network loop
+
+static_assert(ADC_DECIMATE == 1 || ADC_DECIMATE == 2 || ADC_DECIMATE == 4, "ADC_DECIMATE is 1, 2 or 4");
+#if ADC_DECIMATE > 1
+#define ADC_CHANNELS (8/ADC_DECIMATE)                                                       // Same words per block as 8ch TDM, so only 4 or 2 channels
+int32_t   audio_adc[1][2][ISR_BLOCK*ADC_DECIMATE][ADC_CHANNELS] __scratch_x("audio") __attribute__((aligned(2*8*ISR_BLOCK*4))) = { };  // TDM capture at 2X or 4X rate
+int32_t   adc_buf[ADC_CHANNELS][2*ISR_BLOCK+DECIMATE2X_TAPS-1] = { };                       // FIR buffer for the last decimator
+#if ADC_DECIMATE == 4
+int32_t   adc_buf_pre[ADC_CHANNELS][4*ISR_BLOCK+DECIMATE2X_PRE_TAPS-1] = { };               // FIR buffer for the first decimator
+#endif
+#endif
+
+Histogram   isr_call("ISR Call Time", 0, 0.0001);
+Histogram   isr_exec("ISR Exec Time", 0, 0.0001);
+volatile uint32_t isr_worst[2] = { };                                                       // Longest ISR in us, [1] while flash was busy
+volatile bool     flash_busy = false;
+
+
+// Called when a full block of data has been written into audio_tdm
+static void __not_in_flash_func(dma_handler)(void) 
+{
+    hal_dma_ack(deadline.irq_bit);                  // No rush for this, and should never re-enter
+    uint32_t start = hal_timer_us();
+    bool     busy  = flash_busy;                    // Only changes on this core, so not during the ISR
+    if (!busy)
+    {
+        int64_t time = isr_call.time();             // Mark the ISR call time and setup for
+        isr_exec.start(time);                       // measuring execution time
+    }
+
+    int block = hal_dma_read_addr(deadline.dma_out) >= (uintptr_t)&audio_out[0][1][0][0];     // Determine which double buffer to use
+    deadline_start(deadline, block);
+    latency_block(latency);
+
+#if ADC_DECIMATE > 1
+    // Decimate the high rate codec capture down to 48kHz, into the first channels of the tdm buffer
+    for (int n = 0; n < ADC_CHANNELS; n++)
+    {
+        int32_t *pin  = &audio_adc[0][block][0][n];
+        int32_t *pbuf = adc_buf[n];
+        for (int m=0; m<DECIMATE2X_TAPS-1; m++) pbuf[m] = pbuf[m+2*ISR_BLOCK];              // Move the FIR buffer along
+#if ADC_DECIMATE == 4
+        int32_t *ppre = adc_buf_pre[n];
+        for (int m=0; m<DECIMATE2X_PRE_TAPS-1; m++) ppre[m] = ppre[m+4*ISR_BLOCK];
+        for (int m=0; m<4*ISR_BLOCK; m++) ppre[m+DECIMATE2X_PRE_TAPS-1] = pin[ADC_CHANNELS*m] >> DECIMATE_SHIFT;
+        decimate2x_pre(ppre+DECIMATE2X_PRE_TAPS-1, pbuf+DECIMATE2X_TAPS-1, 2*ISR_BLOCK);    // 192kHz to 96kHz
+#else
+        for (int m=0; m<2*ISR_BLOCK; m++) pbuf[m+DECIMATE2X_TAPS-1] = pin[ADC_CHANNELS*m] >> DECIMATE_SHIFT;
+#endif
+        decimate2x(pbuf+DECIMATE2X_TAPS-1, &audio_tdm[0][block][0][n], ISR_BLOCK, 8);         // 96kHz to 48kHz
+    }
+#else
+    // Deinterleave data from I2S four pin, into the tdm buffer     // About 2us per LRCLK @300MHz
+    for (int n=0; n<ISR_BLOCK; n++)
+    {
+        uint32_t w0 = deinterleave4(audio_int[0][block][n][0]);
+        uint32_t w1 = deinterleave4(audio_int[0][block][n][1]);
+        uint32_t w2 = deinterleave4(audio_int[0][block][n][2]);
+        uint32_t w3 = deinterleave4(audio_int[0][block][n][3]);
+
+        audio_tdm[0][block][n][0] = ((  w0 & 0xFF000000 )    ) + ((  w1 & 0xFF000000 )>>8 ) + ((  w2 & 0xFF000000 )>>16) + ((  w3 & 0xFF000000 )>>24);
+        audio_tdm[0][block][n][2] = ((  w0 & 0x00FF0000 )<<8 ) + ((  w1 & 0x00FF0000 )    ) + ((  w2 & 0x00FF0000 )>>8 ) + ((  w3 & 0x00FF0000 )>>16);
+        audio_tdm[0][block][n][4] = ((  w0 & 0x0000FF00 )<<16) + ((  w1 & 0x0000FF00 )<<8 ) + ((  w2 & 0x0000FF00 )    ) + ((  w3 & 0x0000FF00 )>>8);
+        audio_tdm[0][block][n][6] = ((  w0 & 0x000000FF )<<24) + ((  w1 & 0x000000FF )<<16) + ((  w2 & 0x000000FF )<<8 ) + ((  w3 & 0x000000FF ));
+
+        w0 = deinterleave4(audio_int[0][block][n][4]);
+        w1 = deinterleave4(audio_int[0][block][n][5]);
+        w2 = deinterleave4(audio_int[0][block][n][6]);
+        w3 = deinterleave4(audio_int[0][block][n][7]);
+
+        audio_tdm[0][block][n][1] = ((  w0 & 0xFF000000 )    ) + ((  w1 & 0xFF000000 )>>8 ) + ((  w2 & 0xFF000000 )>>16) + ((  w3 & 0xFF000000 )>>24);
+        audio_tdm[0][block][n][3] = ((  w0 & 0x00FF0000 )<<8 ) + ((  w1 & 0x00FF0000 )    ) + ((  w2 & 0x00FF0000 )>>8 ) + ((  w3 & 0x00FF0000 )>>16);
+        audio_tdm[0][block][n][5] = ((  w0 & 0x0000FF00 )<<16) + ((  w1 & 0x0000FF00 )<<8 ) + ((  w2 & 0x0000FF00 )    ) + ((  w3 & 0x0000FF00 )>>8);
+        audio_tdm[0][block][n][7] = ((  w0 & 0x000000FF )<<24) + ((  w1 & 0x000000FF )<<16) + ((  w2 & 0x000000FF )<<8 ) + ((  w3 & 0x000000FF ));
+    }
+#endif
+    deadline_stage(deadline, DL_INPUT);
+
+    latency_capture(latency, LAT_INPUT, audio_tdm[0][block][0], ISR_BLOCK);
+    latency_inject(latency, LAT_NETWORK, latency.src_ch, &audio_tdm[0][block][0][latency.src_ch], 8, ISR_BLOCK, 8);
+    rtp_tx_push(audio_tdm[0][block][0], ISR_BLOCK, 8);                 // Pack the 48kHz input for the network
+#if NET_RX
+    flows_read(audio_tdm[0][block][0], ISR_BLOCK);                     // Jitter buffered network flows mixed into the slots
+#else
+    flows_discard(ISR_BLOCK);                                       // Still played out, so the counters hold
+#endif
+    latency_capture(latency, LAT_NETWORK, audio_tdm[0][block][0], ISR_BLOCK);
+    deadline_stage(deadline, DL_NET);
+
+    /* Move the single channel I2S data into the TDM buffers
+    {
+        int32_t *pin  = audio_i2s[0][block][0];
+        int32_t *pout = audio_tdm[0][block][0];
+        for (int n = 0; n < ISR_BLOCK; n++)
+        {
+            *pout++ = *pin++;
+            *pout++ = *pin++;
+            pout+=6;
+        }
+    }
+    */
+
+    // Route and mix the TDM channels, which is just a pointer for MIX_IDENTITY
+    const int32_t *pmix = mixer_process<MIX_MODE, ISR_BLOCK>(mixer, audio_tdm[0][block][0], audio_mix[0]);
+    eq_swap(eq);
+    deadline_stage(deadline, DL_MIX);
+
+    // Move all of the TDM data into the I2S data buffers and filter    // About 6us per LRCLK at @300MHz
+    for (int n = 0; n < 8; n++)
+    {
+        int32_t *pbuf = audio_buf[n];
+        const int32_t *pin = pmix + n;
+        for (int m=0; m<FILTER2X_TAPS-1; m++) pbuf[m]                 = pbuf[m+ISR_BLOCK];  // Move the FIR buffer along
+        for (int m=0; m<ISR_BLOCK; m++)       pbuf[m+FILTER2X_TAPS-1] = pin[8*m] >> 8;      // Scale down and add new data
+        latency_inject(latency, LAT_OUTPUT, n, pbuf+FILTER2X_TAPS-1, 1, ISR_BLOCK, 0);      // Marker ahead of the EQ and filter
+        eq_process(eq, n, pbuf+FILTER2X_TAPS-1, ISR_BLOCK);                                 // Speaker EQ on the new data
+        int clips = filter2x(pbuf+FILTER2X_TAPS-1, &audio_out[n/2][block][0][n%2], ISR_BLOCK, 2);  // Filter and place into 2X buffer
+        meter_block(meter, n, pbuf+FILTER2X_TAPS-1, ISR_BLOCK, clips);
+        //for (int m=0; m<ISR_BLOCK; m++) audio_out[n/2][block][m][n%2] = pin[8*m];
+    }        
+    meter_publish(meter, ISR_BLOCK);
+    deadline_stage(deadline, DL_OUTPUT);
+    deadline_end(deadline);
+    latency_end(latency, ISR_BLOCK);
+    if (!busy) isr_exec.time();
+    uint32_t took = hal_timer_us() - start;
+    if (took > isr_worst[busy]) isr_worst[busy] = took;
+    tlm_add(TLM_H_ISR_US, took);
+}
+
+
+// Find the FLOW_DEVICES and open their flows, start the latency measurement, and open the RTP transmit
+// and the telemetry.  Called once the W5500 can be reached, before udp_test().  Returns the flows opened,
+// and with none the transmit and telemetry are not opened either.
+int pipeline_start(void)
+{
+    dante_test();
+    const char *flow_devices[FLOW_MAX] = FLOW_DEVICES;
+    int found[FLOW_MAX], nflows = 0;
+    for (int n=0; n<64 && nflows<FLOW_MAX; n++)
+        for (int d=0; d<FLOW_MAX; d++)
+            if (flow_devices[d] && strcmp(dante_devices[n].name,flow_devices[d])==0)
+            {
+                if (dante_devices[n].mcast_ip[0] == 0) printf("\n\nFOUND %s WITH NO MULTICAST FLOW, SKIPPED\n", dante_devices[n].name);
+                else found[nflows++] = n;
+                break;
+            }
+    flows_memory(nflows);                               // RX memory is set before the sockets open
+    for (int k=0; k<nflows; k++)
+    {
+        printf("\n\nFOUND %s\n", dante_devices[found[k]].name);
+        flow_open(k, dante_devices[found[k]].mcast_ip, dante_devices[found[k]].mcast_port, nullptr);    // One to one, so the flows sum
+    }
+    // The delays known from the configuration, for dividing up the measured round trip
+    float lat_parts[LAT_PARTS] = { ISR_BLOCK, ISR_BLOCK, FILTER2X_DELAY,
+                                   ADC_DECIMATE == 1 ? 0 : DECIMATE2X_DELAY + (ADC_DECIMATE == 4 ? DECIMATE2X_PRE_DELAY : 0),
+                                   RTP_TX_FRAMES, 0 };
+    constexpr int lat_path[4] = { LATENCY_PATH };
+    static_assert(NET_RX || LATENCY == LAT_OFF || lat_path[2] != LAT_NETWORK,
+                  "LATENCY_PATH looks for the marker in the received flows, which NET_RX 0 does not play");
+    latency_start(latency, LATENCY, LATENCY_PATH, lat_parts);
+    if (nflows == 0) return 0;
+
+    printf("ELAPSED TIME %10lld us\n\n", (long long)time_us_64());
+    uint8_t tx_ip[4] = RTP_TX_GROUP;
+    rtp_tx_open(tx_ip, RTP_TX_PORT);
+    uint8_t tlm_ip[4] = TLM_GROUP;
+    telemetry_open(tlm_ip, TLM_PORT);
+    return nflows;
+}
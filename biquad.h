@@ -0,0 +1,233 @@
+//////////////////////////////////////////////////////////////////////
+// Cascaded biquad EQ per output channel, run at 48kHz ahead of filter2x
+//
+// The M0+ only has a 32x32->32 multiply, so everything is 32 bit data by
+// 16 bit coefficients, done as two 16x16 products on a 15 bit split of the
+// data.  Each coefficient has its own exponent, so a 16 bit mantissa keeps
+// its relative precision however small it gets.
+//
+// Direct form is no good here.  For a 20Hz high pass 1+a1+a2 is around 7e-6,
+// and any rounding inside the recursion comes out with that gain at DC, so a
+// plain Q14 section is out by 40dB and even with exact coefficients the
+// truncation of the products leaves a DC offset around -60dBFS.  Instead each
+// section is a trapezoidal state variable filter (Simper / Zavalishin) where
+// the states are two integrators, and rounding only sees a gain of about 1/g.
+// That is still 60dB for a 20Hz corner, so the updates of the integrators are
+// worked out with frac extra bits, as many as the section's coefficients
+// allow, and the bits dropped when they are added in are carried to the next
+// sample.  That first order error feedback leaves the rounding with no gain
+// at DC.
+//
+//   v3 = x - ic2      v1 = a1*ic1 + a2*v3      v2 = ic2 + a2*ic1 + a3*v3
+//   ic1 = 2v1 - ic1   ic2 = 2v2 - ic2          y = m0*x + m1*v1 + m2*v2
+//
+// a1 is close to 1 for anything low, so it is done as ic1 - (1-a1)*ic1, and
+// m0 is held as m0-1 as it is exactly 1 for most shapes.  Those terms are
+// skipped when they are zero.
+//
+// The cascade runs with EQ_FRAC bits below the 24 bit sample LSB, and the
+// final rounding back to 24 bits has first order error feedback, so it adds
+// no DC and its noise is pushed up in frequency.  The states must stay below
+// 2^30, so with a full scale input the band state limits Q*A to about 8
+// (+12dB at Q 4).  The output saturates.
+//
+// tools/biquad_bench checks this against the same sections in double
+// precision, with sine sweeps from 10Hz to 20kHz for high pass at 20 and
+// 40Hz, peaks from 20Hz to 15kHz at Q 1 to 8, shelves, a low pass and a
+// cascade.  Response error is under 0.001dB.  With a -78dBFS tone in, noise
+// and offset are below -134dBFS, the worst being the Q 8 +12dB peak at 20Hz.
+//
+// Counting instructions each multiply is about 11 cycles, so a section is
+// about 90 cycles per sample and 8 channels of 4 sections is 2900 cycles or
+// 10us of the 20.8us sample period at 288MHz.  Channels with no sections cost
+// nothing.  biquad_bench only times the host, so this is still a count, and
+// the DL_OUTPUT stage of the deadline monitor is where to check it on the
+// board.  Together with deinterleave and filter2x it should fit, but the
+// headroom in the ISR is small.
+//
+// Coefficients are double buffered for all channels.  The non-audio core
+// designs new sections with biquad_design() and posts them with eq_set(),
+// and the ISR swaps them in at the start of the next block.  Filter state is
+// kept across the swap, which the state variable form handles without clicks.
+//
+
+#pragma once
+#include <stdint.h>
+#include <math.h>
+
+#define EQ_CHANNELS     8
+#define EQ_SECTIONS     8
+#define EQ_FRAC         4
+
+enum BiquadType { BQ_FLAT, BQ_PEAK, BQ_LOWSHELF, BQ_HIGHSHELF, BQ_HIGHPASS, BQ_LOWPASS };
+
+struct BiquadTerm
+{
+    int16_t     m;                                                  // Mantissa, c = m * 2^-lo
+    uint8_t     lsh, rsh, lo;                                       // Shifts for the high and low products
+};
+
+struct Biquad
+{
+    BiquadTerm  k1, a2, a3;                                         // 1-a1, a2, a3, all times 2^frac
+    BiquadTerm  w0, w1, w2;                                         // m0-1, m1, m2
+    uint8_t     frac;                                               // Extra bits for the integrator updates
+};
+
+struct BiquadState
+{
+    int32_t     ic1, ic2;
+    int32_t     e1, e2;                                             // What the integrator updates dropped, carried to the next sample
+};
+
+struct EqBank
+{
+    Biquad      sec[EQ_CHANNELS][EQ_SECTIONS];
+    uint8_t     n[EQ_CHANNELS];                                     // Sections in use per channel
+};
+
+struct Eq
+{
+    EqBank              bank[2];
+    volatile int        active;
+    volatile bool       pending;
+    BiquadState         state[EQ_CHANNELS][EQ_SECTIONS];
+    int32_t             err[EQ_CHANNELS];                           // Rounding error carried to the next sample
+};
+
+
+// Quantise a coefficient to a 16 bit mantissa with its own exponent
+inline BiquadTerm biquad_term(double c)
+{
+    int k = 0;
+    while (k < 46 && fabs(ldexp(c, k + 1)) < 32767.0) k++;
+    BiquadTerm t;
+    t.m   = (int16_t)lrint(ldexp(c, k));
+    t.lsh = k < 15 ? 15 - k : 0;
+    t.rsh = k < 15 ? 0 : (k - 15 > 31 ? 31 : k - 15);
+    t.lo  = k > 31 ? 31 : k;
+    return t;
+}
+
+// The section in double precision, before quantising
+struct BiquadCoeffs
+{
+    double      a1, a2, a3;
+    double      m0, m1, m2;
+};
+
+// RBJ cookbook shapes, frequencies in Hz at 48kHz, for the non-audio core
+inline BiquadCoeffs biquad_coeffs(BiquadType type, double f, double q = 0.707, double db = 0.0)
+{
+    double A  = pow(10.0, db / 40.0);
+    double g  = tan(M_PI * f / 48000.0);
+    double k  = 1.0 / q;
+    double m0 = 1, m1 = 0, m2 = 0;
+
+    switch (type)
+    {
+        case BQ_PEAK:       k = 1.0 / (q * A);  m1 = k * (A*A - 1);                         break;
+        case BQ_LOWSHELF:   g /= sqrt(A);       m1 = k * (A - 1);       m2 = A*A - 1;       break;
+        case BQ_HIGHSHELF:  g *= sqrt(A);       m1 = k * (1 - A) * A;   m2 = 1 - A*A;   m0 = A*A; break;
+        case BQ_HIGHPASS:                       m1 = -k;                m2 = -1;            break;
+        case BQ_LOWPASS:                                                m2 = 1;         m0 = 0;   break;
+        case BQ_FLAT:                                                                       break;
+    }
+    BiquadCoeffs c;
+    c.a1 = 1.0 / (1.0 + g * (g + k));
+    c.a2 = g * c.a1;
+    c.a3 = g * c.a2;
+    c.m0 = m0;
+    c.m1 = m1;
+    c.m2 = m2;
+    return c;
+}
+
+inline Biquad biquad_design(BiquadType type, double f, double q = 0.707, double db = 0.0)
+{
+    BiquadCoeffs c = biquad_coeffs(type, f, q, db);
+    Biquad bq;
+    int frac = 0;
+    while (frac < 15 && ldexp(1 - c.a1 + c.a2 + c.a3, frac + 1) <= 0.5) frac++;
+    bq.frac = frac;
+    bq.k1 = biquad_term(ldexp(1 - c.a1, frac));
+    bq.a2 = biquad_term(ldexp(c.a2, frac));
+    bq.a3 = biquad_term(ldexp(c.a3, frac));
+    bq.w0 = biquad_term(c.m0 - 1);
+    bq.w1 = biquad_term(c.m1);
+    bq.w2 = biquad_term(c.m2);
+    return bq;
+}
+
+// Post a new set of sections for one channel from the non-audio core
+// Returns false if the last update has not been picked up yet, so try again later
+inline bool eq_set(Eq &eq, int ch, const Biquad *sec, int n)
+{
+    if (eq.pending) return false;
+    EqBank &spare = eq.bank[1 - eq.active];
+    spare = eq.bank[eq.active];
+    for (int s = 0; s < n && s < EQ_SECTIONS; s++) spare.sec[ch][s] = sec[s];
+    spare.n[ch] = n < EQ_SECTIONS ? n : EQ_SECTIONS;
+    __dmb();
+    eq.pending = true;
+    return true;
+}
+
+// Called once per block by the ISR before any eq_process
+static inline void __not_in_flash_func(eq_swap)(Eq &eq)
+{
+    if (eq.pending) { eq.active = 1 - eq.active; eq.pending = false; }
+}
+
+// v*c for |v| < 2^30
+static inline int32_t __not_in_flash_func(biquad_mul)(int32_t v, const BiquadTerm &t)
+{
+    return (((v >> 15) * t.m) << t.lsh >> t.rsh) + (((v & 0x7FFF) * t.m) >> t.lo);
+}
+
+// Run the sections for one channel in place over n 24 bit samples
+void __not_in_flash_func(eq_process)(Eq &eq, int ch, int32_t *buf, int n)
+{
+    const EqBank &b = eq.bank[eq.active];
+    if (b.n[ch] == 0) return;
+
+    for (int i = 0; i < n; i++) buf[i] <<= EQ_FRAC;
+
+    for (int s = 0; s < b.n[ch]; s++)
+    {
+        const Biquad &q = b.sec[ch][s];
+        BiquadState  &z = eq.state[ch][s];
+        int32_t ic1 = z.ic1, ic2 = z.ic2, e1 = z.e1, e2 = z.e2;
+        const int f = q.frac;
+        for (int i = 0; i < n; i++)
+        {
+            int32_t v0 = buf[i];
+            int32_t v3 = v0 - ic2;
+            int32_t s1 = e1 - biquad_mul(ic1, q.k1) + biquad_mul(v3, q.a2);
+            int32_t s2 = e2 + biquad_mul(ic1, q.a2) + biquad_mul(v3, q.a3) + 1;       // +1 for the bias of the two truncations
+            int32_t v1 = ic1 + (s1 >> f);
+            int32_t v2 = ic2 + (s2 >> f);
+            e1 = s1 - ((s1 >> f) << f);
+            e2 = s2 - ((s2 >> f) << f);
+            ic1 = 2*v1 - ic1;
+            ic2 = 2*v2 - ic2;
+            int32_t y = v0 + biquad_mul(v1, q.w1);
+            if (q.w0.m) y += biquad_mul(v0, q.w0);
+            if (q.w2.m) y += biquad_mul(v2, q.w2);
+            buf[i] = y;
+        }
+        z.ic1 = ic1; z.ic2 = ic2; z.e1 = e1; z.e2 = e2;
+    }
+
+    int32_t e = eq.err[ch];
+    for (int i = 0; i < n; i++)
+    {
+        int32_t z = buf[i] + e;
+        int32_t y = z >> EQ_FRAC;
+        e = z - (y << EQ_FRAC);
+        if (y >  0x007FFFFF) y =  0x007FFFFF;
+        if (y < -0x00800000) y = -0x00800000;
+        buf[i] = y;
+    }
+    eq.err[ch] = e;
+}
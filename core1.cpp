@@ -9,9 +9,14 @@
 #include "hardware/vreg.h"
 #include "hardware/sync.h"
 #include "pico/stdlib.h"
+#include "pico/multicore.h"
 #include "hardware/flash.h"
 #include "i2s.pio.h"
 #include "histogram.hpp"
+#include "meter.h"
+#include "deadline.h"
+#include "latency.h"
+#include "http_stream.h"
 
 using namespace DAES67;
 
@@ -19,66 +24,68 @@ extern "C" {
 #include "port_common.h"
 #include "wizchip_conf.h"
 #include "w5x00_spi.h"
-#include "httpServer.h"
 }
 
-#define ETHERNET_BUF_MAX_SIZE (1024 * 2)
-#define HTTP_SOCKET_MAX_NUM 4
+#define HTTP_SOCKET_MAX_NUM 2
+#define HTTP_PORT           80
 
-static wiz_NetInfo g_net_info =
-    {
-        .mac = {0x00, 0x08, 0xDC, 0x12, 0x34, 0x56}, // MAC address
-        .ip = {10, 0, 0, 99},                     // IP address
-        .sn = {255, 255, 0, 0},                    // Subnet Mask
-        .gw = {10, 0, 0, 1},                     // Gateway
-        .dns = {8, 8, 8, 8},                         // DNS server
-        .dhcp = NETINFO_STATIC                       // DHCP enable/disable
-};
 
-static uint8_t g_http_send_buf[ETHERNET_BUF_MAX_SIZE] = {};
-static uint8_t g_http_recv_buf[ETHERNET_BUF_MAX_SIZE] = {};
-static uint8_t g_http_socket_num_list[HTTP_SOCKET_MAX_NUM] = {0, 1, 2, 3};
+static HttpStream g_http;
+static uint8_t g_http_socket_num_list[HTTP_SOCKET_MAX_NUM] = {0, 1};
 
 
 extern Histogram   isr_call;
 extern Histogram   isr_exec;
+extern volatile uint32_t isr_worst[2];
+uint32_t           stack_spare(void);
+extern Meter       meter;
+extern Deadline    deadline;
+extern Latency     latency;
 
-void core1(void)
-{
-    printf("**** CORE1 IS ALIVE  \n");
-    sleep_ms(2000);
-
-    wizchip_spi_initialize();
-    wizchip_cris_initialize();
 
-    wizchip_reset();
-    wizchip_initialize();
-    wizchip_check();
+// The statistics page, each part goes out as it is written
+static void stats_page(HttpStream &s)
+{
+    http_printf(s, "<!DOCTYPE html><html lang=\"en\"><head><meta charset=\"UTF-8\"><title>HTTP Server Example</title></head><body><h1>STATISTICS</h1><pre>");
+    http_printf(s, "\nTime %lld\n", isr_call.now());
 
-    network_initialize(g_net_info);
+    int   room;
+    char *p = http_reserve(s, HTTP_SCRATCH, room);                 // text() takes no size, so it gets the whole scratch,
+    isr_call.text(20, p);                                           // which 20 rows fit in with room to spare
+    http_commit(s, strlen(p));
+    http_printf(s, "\n");
+    p = http_reserve(s, HTTP_SCRATCH, room);
+    isr_exec.text(20, p);
+    http_commit(s, strlen(p));
+    http_printf(s, "\nISR WORST     %6lu us   while writing flash %6lu us\n", (unsigned long)isr_worst[0], (unsigned long)isr_worst[1]);
+    http_printf(s, "STACK SPARE   %6lu bytes of the core 0 stack never used\n\n", (unsigned long)stack_spare());
 
-    httpServer_init(g_http_send_buf, g_http_recv_buf, HTTP_SOCKET_MAX_NUM, g_http_socket_num_list);
+    p = http_reserve(s, 2048, room);
+    http_commit(s, deadline_text(deadline, p, room));
+    http_printf(s, "\n");
 
-    //
-    print_network_information(g_net_info);          // This will stall waiting for a network
+    MeterSnapshot levels;
+    meter_read(meter, levels);
+    p = http_reserve(s, 1024, room);
+    http_commit(s, meter_text(levels, p, room));
+    http_printf(s, "\n");
+    p = http_reserve(s, 1024, room);
+    http_commit(s, latency_text(latency, p, room));
+    http_printf(s, "\n\n</pre></body></html>");
+}
 
-    char web_preamble[] = "<!DOCTYPE html><html lang=\"en\"><head><meta charset=\"UTF-8\"><title>HTTP Server Example</title></head><body><h1>STATISTICS</h1><pre>";
-    char web_close[]    = "</pre></body></html>"; 
+// Launched by main() once core 0 has the W5500 up, which it shares with the network loop there.
+// Sockets 0 and 1 are left for this, and the SPI lock from dante_test() keeps the two cores apart.
+void core1(void)
+{
+    printf("**** CORE1 IS ALIVE  \n");
+    multicore_lockout_victim_init();                // So core 0 can pause us while it writes flash
 
-    char page[8000];
-    char tmp[3000];
-    
     while (1)
     {
         for (int i = 0; i < HTTP_SOCKET_MAX_NUM; i++)
         {
-            sprintf(page,"%s\nTime %lld\n",web_preamble,isr_call.now());
-            isr_call.text(20, tmp);
-            sprintf(page+strlen(page),"%s\n", tmp);
-            isr_exec.text(20, tmp);
-            sprintf(page+strlen(page),"%s\n\n%s", tmp,web_close);
-            reg_httpServer_webContent((unsigned char*)"index.html", (unsigned char*) page);
-            httpServer_run(i);
+            http_serve(g_http, g_http_socket_num_list[i], HTTP_PORT, stats_page);
         }
     }    
 }
@@ -2,9 +2,11 @@
 // Simple code to snoop for Dante multicast streams
 //
 
+#pragma once
 #include "histogram.hpp"
 
 extern "C" {
+#include "hardware/sync.h"
 #include "port_common.h"
 #include "wizchip_conf.h"
 #include "w5x00_spi.h"
@@ -23,7 +25,7 @@ using namespace DAES67;
 // Construct a mdns query for services to respond
 int mdns_query(const char* name, uint8_t *buf, int len)               
 {
-    if (len < 18 + strlen(name)) { return 0; };
+    if (len < 18 + (int)strlen(name)) { return 0; };
     
     int n = 0;
     buf[n++] = 0;       // Transaction ID
@@ -109,11 +111,28 @@ static void wizchip_write_burst(uint8_t *pBuf, uint16_t len)
     spi_write_blocking(SPI_PORT, pBuf, len);
 }
 
+// The W5500 is shared by the network loop on core 0 and the HTTP server on core 1, so each SPI
+// transaction holds a spin lock.  wizchip_cris_initialize() does that with the interrupts off, which
+// for a 2k burst read would hold off the audio ISR for half a millisecond.  The ISR never touches the
+// SPI, so this lock leaves them on.
+static spin_lock_t *wizchip_lock;
+
+static void wizchip_lock_enter(void)
+{
+    spin_lock_unsafe_blocking(wizchip_lock);
+}
+
+static void wizchip_lock_exit(void)
+{
+    spin_unlock_unsafe(wizchip_lock);
+}
+
 
 void dante_test(void)
 {
     wizchip_spi_initialize();           // NOTE MAKE SURE TO PATCH THIS TO BE 36Mhz not 5Mhz SPI
-    wizchip_cris_initialize();
+    wizchip_lock = spin_lock_init(spin_lock_claim_unused(true));
+    reg_wizchip_cris_cbfunc(wizchip_lock_enter, wizchip_lock_exit);
     wizchip_reset();
     wizchip_initialize();
     
@@ -132,7 +151,7 @@ void dante_test(void)
 
 
     // First send the MDNS query to get all Dante devices to respond
-    uint8_t packet[2048];
+    static uint8_t packet[2048];                                    // Not on the 2k core 0 stack
     uint8_t multicast_ip[4] = {224,0,0,251};
     uint8_t multicast_mac[6] = {0x01, 0x00, 0x5E, 0, 0, 251};
     setSn_MR(MDNS_TX, Sn_MR_UDP);
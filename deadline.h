@@ -0,0 +1,198 @@
+//////////////////////////////////////////////////////////////////////
+// Deadline monitor for dma_handler, measured against the DMA itself
+//
+// If the ISR runs long nothing fails loudly.  The output DMA just plays the
+// old contents of audio_out again and the input DMA writes over audio_int,
+// so the only sign was the tail of the isr_exec histogram.  This takes its
+// time from the output DMA's read address, so it is in units of what the
+// hardware has actually consumed rather than a separate timer.
+//
+// deadline_start() is given the half of audio_out the ISR is writing, which
+// is the one the output DMA is part way through, and deadline_stage() after
+// each stage of the ISR works out how far the DMA has read into that half.
+// The budget is what is left of the block when the DMA gets to its end, so
+// the interrupt latency before the ISR ran counts against it as well as the
+// ISR itself.  A stage that takes the total past the block is counted
+// as a miss for that stage, and one that takes it past 3/4 as a near miss,
+// each only once per ISR so the counts say which stage used the last of the
+// time.  The worst total at the end of each stage is kept too, which is the
+// headroom to quote for a configuration.
+//
+// The read address wraps every two blocks, so a really late ISR would read
+// as early.  deadline_end() also checks whether the next block's interrupt
+// is already pending, which is a certain miss whatever the address says.
+//
+// The PIO FDEBUG flags are checked at the end of each ISR and cleared.
+// RXSTALL on the input machine is set when push noblock found the FIFO full,
+// which means the input DMA fell behind and samples were dropped.  TXSTALL on
+// the output machines is only raised by a blocking pull, and i2s_double_out
+// uses pull noblock and repeats the last word instead, so it can only show
+// up with a blocking output program.  Neither should happen from the ISR
+// being late, they point at bus contention or a DMA that has stopped.
+//
+// Misses, late interrupts and stalls also go into a small ring of events
+// with the time, for the status page.  Everything that runs in the ISR is in
+// RAM and only touches registers and this struct.
+//
+
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include "hal.h"
+
+#define DL_STAGES       4
+#define DL_EVENTS       16                                          // Must be a power of two
+#define DL_TEXT_LINE    128                                         // Longest line of deadline_text()
+
+enum DeadlineStage { DL_INPUT, DL_NET, DL_MIX, DL_OUTPUT };
+enum DeadlineEvent { DL_MISS, DL_LATE, DL_RXSTALL, DL_TXSTALL };
+
+struct DlEvent
+{
+    uint32_t    time_us;
+    uint8_t     kind;
+    uint8_t     stage;
+    uint16_t    value;                                              // Words used, or the FDEBUG bits
+};
+
+struct Deadline
+{
+    // Set up by deadline_init()
+    bool                active;
+    int                 dma_out;                                    // Output data channel to watch
+    uintptr_t           base;                                       // Its double buffer
+    uint32_t            words, near, mask;                          // Words per block, near miss level, words in both halves - 1
+    uint32_t            irq_bit;                                    // The interrupt that starts the next block
+    pio_hw_t           *pio_in, *pio_out;
+    uint32_t            rx_bits, tx_bits;                           // FDEBUG bits of the machines in use
+
+    // Per ISR
+    uint32_t            entry;                                      // First word of the half being written
+    bool                missed, nearly;
+
+    // Counters
+    uint32_t            blocks;
+    uint32_t            worst[DL_STAGES];                           // Largest words used by the end of each stage
+    uint32_t            miss[DL_STAGES];
+    uint32_t            near_miss[DL_STAGES];
+    uint32_t            late;
+    uint32_t            rxstall, txstall;
+    volatile uint32_t   events;                                     // Total written, the ring holds the last DL_EVENTS
+    DlEvent             event[DL_EVENTS];
+};
+
+
+// dma_in and dma_out are the data channels returned by dma_setup(), words is one block of the output.
+// Before the DMA interrupt is enabled, as dma_handler() acks irq_bit and picks the block from dma_out
+inline void deadline_init(Deadline &dl, pio_hw_t *pio_in, int sm_in, int dma_in, pio_hw_t *pio_out, uint32_t sm_out_mask, int dma_out, const int32_t *out_buf, int words)
+{
+    uint32_t chain = hal_dma_chain(dma_in);
+    dl.dma_out = dma_out;
+    dl.base    = (uintptr_t)out_buf;
+    dl.words   = words;
+    dl.near    = words - words / 4;
+    dl.mask    = 2 * words - 1;
+    dl.irq_bit = 1u << chain;                                       // The control channel raises the interrupt
+    dl.pio_in  = pio_in;
+    dl.pio_out = pio_out;
+    dl.rx_bits = 1u << (PIO_FDEBUG_RXSTALL_LSB + sm_in);
+    dl.tx_bits = sm_out_mask << PIO_FDEBUG_TXSTALL_LSB;
+    hal_pio_stalls(pio_in, dl.rx_bits);
+    hal_pio_stalls(pio_out, dl.tx_bits);
+    __dmb();
+    dl.active  = true;
+}
+
+static inline void __not_in_flash_func(deadline_event)(Deadline &dl, int kind, int stage, uint32_t value)
+{
+    DlEvent &e = dl.event[dl.events % DL_EVENTS];
+    e.time_us = hal_timer_us();
+    e.kind    = kind;
+    e.stage   = stage;
+    e.value   = value > 0xFFFF ? 0xFFFF : value;
+    __dmb();
+    dl.events++;
+}
+
+// Words the output DMA has read since the start of its double buffer, modulo two blocks
+static inline uint32_t __not_in_flash_func(deadline_position)(const Deadline &dl)
+{
+    return ((hal_dma_read_addr(dl.dma_out) - dl.base) >> 2) & dl.mask;
+}
+
+// At the top of the ISR, block is the half of the output double buffer it writes
+static inline void __not_in_flash_func(deadline_start)(Deadline &dl, int block)
+{
+    if (!dl.active) return;
+    dl.entry  = block * dl.words;
+    dl.missed = dl.nearly = false;
+    dl.blocks++;
+}
+
+// After each stage of the ISR
+static inline void __not_in_flash_func(deadline_stage)(Deadline &dl, int stage)
+{
+    if (!dl.active) return;
+    uint32_t used = (deadline_position(dl) - dl.entry) & dl.mask;
+    if (used > dl.worst[stage]) dl.worst[stage] = used;
+    if (used >= dl.words && !dl.missed)
+    {
+        dl.missed = true;
+        dl.miss[stage]++;
+        deadline_event(dl, DL_MISS, stage, used);
+    }
+    else if (used >= dl.near && !dl.nearly)
+    {
+        dl.nearly = true;
+        dl.near_miss[stage]++;
+    }
+}
+
+// At the end of the ISR, after the last deadline_stage()
+static inline void __not_in_flash_func(deadline_end)(Deadline &dl)
+{
+    if (!dl.active) return;
+    if (hal_dma_pending(dl.irq_bit))
+    {
+        dl.late++;
+        deadline_event(dl, DL_LATE, DL_OUTPUT, (deadline_position(dl) - dl.entry) & dl.mask);
+    }
+
+    uint32_t rx = hal_pio_stalls(dl.pio_in,  dl.rx_bits);
+    uint32_t tx = hal_pio_stalls(dl.pio_out, dl.tx_bits);
+    if (rx)
+    {
+        dl.rxstall++;
+        deadline_event(dl, DL_RXSTALL, 0, rx >> PIO_FDEBUG_RXSTALL_LSB);
+    }
+    if (tx)
+    {
+        dl.txstall++;
+        deadline_event(dl, DL_TXSTALL, 0, tx >> PIO_FDEBUG_TXSTALL_LSB);
+    }
+}
+
+// Counters and the recent events, for the other core, stopping short of size bytes
+inline int deadline_text(const Deadline &dl, char *buf, int size)
+{
+    static const char *stage[DL_STAGES] = { "INPUT", "NET", "MIX", "OUTPUT" };
+    static const char *kind[4]          = { "MISS", "LATE", "RXSTALL", "TXSTALL" };
+
+    char *p = buf, *end = buf + size;
+    if (size < (2 + DL_STAGES) * DL_TEXT_LINE) return 0;           // The counters and stages, then the events as they fit
+    p += sprintf(p, "DEADLINE      blocks %10lu  late %6lu  rx stall %6lu  tx stall %6lu\n",
+                 (unsigned long)dl.blocks, (unsigned long)dl.late, (unsigned long)dl.rxstall, (unsigned long)dl.txstall);
+    p += sprintf(p, "STAGE         worst words   of block     near     miss\n");
+    for (int s = 0; s < DL_STAGES; s++)
+        p += sprintf(p, "%-12s  %11lu  %8lu%%  %7lu  %7lu\n", stage[s], (unsigned long)dl.worst[s],
+                     dl.words ? (unsigned long)(100 * dl.worst[s] / dl.words) : 0UL, (unsigned long)dl.near_miss[s], (unsigned long)dl.miss[s]);
+
+    uint32_t n = dl.events;
+    for (uint32_t i = n > DL_EVENTS ? n - DL_EVENTS : 0; i < n && end - p >= DL_TEXT_LINE; i++)
+    {
+        DlEvent e = dl.event[i % DL_EVENTS];
+        p += sprintf(p, "EVENT %10lu us  %-8s %-8s %5u\n", (unsigned long)e.time_us, kind[e.kind & 3],
+                     e.kind == DL_MISS || e.kind == DL_LATE ? stage[e.stage & 3] : "", e.value);
+    }
+    return p - buf;
+}
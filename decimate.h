@@ -0,0 +1,93 @@
+// Create a set of samples at half the input rate using fixed half band filters
+// Used to bring 96kHz or 192kHz codec capture down to 48kHz for the network
+// The input should already be scaled down by DECIMATE_SHIFT bits for the math and headroom
+// The filters use 13 bit coefficients, with the centre tap of 0.5 done as a shift
+// The taps are symmetric, so pairs of samples are summed before the multiply
+// Allow the output to be written in interleaved format
+//
+// decimate2x     96kHz to 48kHz (or last stage of 192kHz to 48kHz)
+//                51 taps (13 multiplies per output), pass 0-20kHz +-0.005dB, stop >28kHz 66dB
+// decimate2x_pre 192kHz to 96kHz ahead of decimate2x
+//                15 taps (4 multiplies per output), pass 0-20kHz +-0.002dB, stop >76kHz 73dB
+//
+// Anything between 20kHz and 28kHz aliases into 20-24kHz at the output, which is outside of the
+// audio band.  The 4X path keeps the 66dB of the second stage.
+//
+// h = sinc half band with kaiser(51, 7) or kaiser(15, 6.5), round(h*8192) and then each coefficient
+// nudged by +-1 in turn while it improved the worst case stop band.  Sum of |h| is 1.65 (51) or 1.28 (15)
+// so DECIMATE_SHIFT of 14 leaves 18 bits of signal (108dB) while the accumulator stays below 2^31.
+//
+// Same tricks as filter2x.  The index is from the oldest sample since M0+ only has positive load offset.
+// Both run from RAM like filter2x.
+//
+// The cost has not been measured on the M0+.  Counting instructions, each symmetric tap is two loads, an
+// add, the coefficient and a multiply and accumulate, about 9 cycles, so decimate2x is about 140 cycles an
+// output and decimate2x_pre about 50.  With ISR_BLOCK 4 and the FIR buffer shifts that is about 3000 cycles
+// a block at 2X (4 channels) and 2400 at 4X (2 channels), 10us or less of the 83us block at 288MHz.
+// tools/decimate_bench only times the host.  On the board the DL_INPUT stage of the deadline monitor
+// covers it, but only once the capture lands in audio_adc, and nothing sets up that DMA yet (audio_start()).
+//
+
+#define DECIMATE2X_TAPS     51
+#define DECIMATE2X_PRE_TAPS 15
+#define DECIMATE2X_DELAY    12.5f                                   // Group delay in 48kHz frames, 25 samples at 96kHz
+#define DECIMATE2X_PRE_DELAY 1.75f                                  // 7 samples at 192kHz
+#define DECIMATE_SHIFT      14
+#define DECIMATE_MAX        ((1<<(31-DECIMATE_SHIFT))-1)
+#define DECIMATE_MIN        (-(1<<(31-DECIMATE_SHIFT)))
+#define DTAP(a, c, k)       { z += a * (*(p+c-k) + *(p+c+k)); }
+
+// Takes 2n samples at *in, with DECIMATE2X_TAPS-1 previous samples before *in
+// Writes n full scale int32 samples
+void __not_in_flash_func(decimate2x)(int32_t *in, int32_t *out, int n, int out_stride = 1)
+{
+    int32_t *p = in - 50;                       // Oldest sample of the first output
+    for (int i = 0; i < n; i++)
+    {
+        int32_t z = *(p+25) << 12;              // Centre tap of 0.5 at 2^13
+
+        DTAP( 2596, 25,  1);
+        DTAP( -833, 25,  3);
+        DTAP(  462, 25,  5);
+        DTAP( -294, 25,  7);
+        DTAP(  194, 25,  9);
+        DTAP( -130, 25, 11);
+        DTAP(   85, 25, 13);
+        DTAP(  -54, 25, 15);
+        DTAP(   32, 25, 17);
+        DTAP(  -18, 25, 19);
+        DTAP(    9, 25, 21);
+        DTAP(   -4, 25, 23);
+        DTAP(    1, 25, 25);
+
+        z = (z + (1<<12)) >> 13;
+        if (z > DECIMATE_MAX) z = DECIMATE_MAX;
+        if (z < DECIMATE_MIN) z = DECIMATE_MIN;
+        *out = z << DECIMATE_SHIFT;
+        out += out_stride;
+        p += 2;
+    }
+}
+
+// Takes 2n samples at *in, with DECIMATE2X_PRE_TAPS-1 previous samples before *in
+// Writes n samples still scaled down by DECIMATE_SHIFT, ready to feed decimate2x
+void __not_in_flash_func(decimate2x_pre)(int32_t *in, int32_t *out, int n, int out_stride = 1)
+{
+    int32_t *p = in - 14;
+    for (int i = 0; i < n; i++)
+    {
+        int32_t z = *(p+7) << 12;
+
+        DTAP( 2487, 7, 1);
+        DTAP( -561, 7, 3);
+        DTAP(  143, 7, 5);
+        DTAP(  -21, 7, 7);
+
+        z = (z + (1<<12)) >> 13;
+        if (z > DECIMATE_MAX) z = DECIMATE_MAX;
+        if (z < DECIMATE_MIN) z = DECIMATE_MIN;
+        *out = z;
+        out += out_stride;
+        p += 2;
+    }
+}
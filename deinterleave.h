@@ -1,10 +1,12 @@
 // Simple table lookup and compound function to deinterleave a 32 bit word as four 8 bit bytes.
+// The table is read 32 times per frame by the ISR, so it lives in scratch Y with the core 0 stack
+// where neither the DMA nor core 1 ever touch it.
 
 #include <stdint.h>
 
 // for n=0:255, a = dec2bin(n,8); b(n+1) = bin2dec([a([4 8]) '000000' a([3 7]) '000000' a([2 6]) '000000' a([1 5])]); end;
 // fprintf("   0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X, \n",b)
-static int32_t Table_Deinterleave4[256] = {
+static int32_t __scratch_y("deinterleave") Table_Deinterleave4[256] = {
    0x00000000, 0x01000000, 0x00010000, 0x01010000, 0x00000100, 0x01000100, 0x00010100, 0x01010100, 0x00000001, 0x01000001, 0x00010001, 0x01010001, 0x00000101, 0x01000101, 0x00010101, 0x01010101, 
    0x02000000, 0x03000000, 0x02010000, 0x03010000, 0x02000100, 0x03000100, 0x02010100, 0x03010100, 0x02000001, 0x03000001, 0x02010001, 0x03010001, 0x02000101, 0x03000101, 0x02010101, 0x03010101, 
    0x00020000, 0x01020000, 0x00030000, 0x01030000, 0x00020100, 0x01020100, 0x00030100, 0x01030100, 0x00020001, 0x01020001, 0x00030001, 0x01030001, 0x00020101, 0x01020101, 0x00030101, 0x01030101, 
@@ -22,7 +24,7 @@ static int32_t Table_Deinterleave4[256] = {
    0x00020202, 0x01020202, 0x00030202, 0x01030202, 0x00020302, 0x01020302, 0x00030302, 0x01030302, 0x00020203, 0x01020203, 0x00030203, 0x01030203, 0x00020303, 0x01020303, 0x00030303, 0x01030303, 
    0x02020202, 0x03020202, 0x02030202, 0x03030202, 0x02020302, 0x03020302, 0x02030302, 0x03030302, 0x02020203, 0x03020203, 0x02030203, 0x03030203, 0x02020303, 0x03020303, 0x02030303, 0x03030303 };
 
-uint32_t inline deinterleave4(uint32_t x)
+static inline uint32_t __not_in_flash_func(deinterleave4)(uint32_t x)
 {
     return Table_Deinterleave4[x & 0xFF] | (Table_Deinterleave4[(x >> 8) & 0xFF] << 2) | (Table_Deinterleave4[(x >> 16) & 0xFF] << 4) | (Table_Deinterleave4[(x >> 24) & 0xFF] << 6);
 }
@@ -0,0 +1,270 @@
+//////////////////////////////////////////////////////////////////////
+// Receive up to four multicast flows at once and mix them into the TDM slots
+//
+// Each flow has its own W5500 socket, FLOW_SOCK upwards, and its own jitter
+// buffer.  The map for a flow gives, for each TDM slot, the channel of that
+// flow's packets that should go there (or -1).  So two 8ch consoles can be
+// summed into one amp by giving both the one to one map, or a pair can be
+// taken from each by mapping them into different slots.
+//
+// The W5500 only has 2k of RX buffer per socket with the default split,
+// which is one 8ch packet.  flows_memory() gives the flow sockets the RX
+// memory the others don't need, 8k for one flow and 4k each for two, but
+// with three or four it is still 2k each.  So rather than going round the
+// sockets in turn,
+// flow_service() reads the RX size of every open flow and services the one
+// that is fullest.  That is one short register read per flow each time round,
+// and then the whole of that socket's data in one burst, as in udp_test.
+// tools/pcap_replay compares this with other ways of reading on the same
+// traffic, which is why the read and the parse are separate functions.
+//
+// The ISR calls flows_read(), which plays each flow's jitter buffer and adds
+// the mapped channels into the output with saturation.  Slots no flow maps
+// to are left silent.  With NET_RX off it calls flows_discard() instead, so
+// the flows are still played out and their counters mean the same, but
+// nothing is mixed in.
+//
+// A datagram bigger than the burst buffer could never be taken whole, so
+// rather than leave it at the head of the socket for good it is skipped
+// and counted as oversize.
+//
+// Throughput and loss are kept per flow.  Loss is from the RTP sequence
+// numbers as in RFC3550, the expected count less the received count, so it
+// is what the network dropped rather than what was late for playout.
+//
+// Sockets 0 and 1 are left for HTTP on core1, 2 for telemetry (and mDNS
+// before the flows start), and 7 for the RTP transmit.
+//
+
+#pragma once
+#include <string.h>
+#include "jitter.h"
+
+extern "C" {
+#include "port_common.h"
+#include "wizchip_conf.h"
+#include "w5x00_spi.h"
+#include "socket.h"
+}
+
+#define FLOW_MAX        4
+#define FLOW_SOCK       3                                           // Sockets 3 to 6
+#define FLOW_BUF        2048                                        // Most read in one burst, one 8ch packet and change
+#define FLOW_RX_KB      10                                          // RX memory for the flows, 16k less 2k each for sockets 0 to 2
+#define FLOW_TX_KB      8                                           // TX memory of socket 7, a power of two in the 10k the flows leave
+
+struct Flow
+{
+    Jitter              jb;
+    volatile bool       active;
+    int                 sock;
+    uint8_t             ip[4];
+    uint16_t            port;
+    int8_t              map[JB_CHANNELS];                           // Packet channel for each TDM slot, or -1
+    bool                seen;
+    uint32_t            first, highest;                             // Extended sequence numbers for the loss count
+    uint32_t            packets, bytes, reads;
+    uint32_t            oversize;                                   // Datagrams too big for one read, skipped
+    uint32_t            last_bytes;
+};
+
+Flow flows[FLOW_MAX] = { };
+
+
+// Read the two byte RX received size register of a socket in one transaction
+int check_rsr(int sock)
+{
+    uint8_t req[3] = {0x00, 0x26, (uint8_t)(((4*sock+1)<<3) + 0)};
+    uint8_t val[2] = { };
+
+    WIZCHIP_CRITICAL_ENTER();
+    WIZCHIP.CS._select();
+    spi_write_blocking(SPI_PORT, req, 3);
+    spi_read_blocking(SPI_PORT, 0x00, val, 2);
+    WIZCHIP.CS._deselect();
+    WIZCHIP_CRITICAL_EXIT();
+
+    return (val[0] << 8) | val[1];
+}
+
+// Share the RX memory out for nflows flows, before they are opened
+// Sockets 0 to 2 keep 2k, and socket 7 only transmits so it gets none.  The flows only receive, so
+// their TX memory goes to socket 7, for the RTP transmit to stage a packet while the last is sent.
+void flows_memory(int nflows)
+{
+    int kb = 8;
+    while (kb > 2 && nflows * kb > FLOW_RX_KB) kb >>= 1;
+    for (int n = 0; n < FLOW_MAX; n++) setSn_RXBUF_SIZE(FLOW_SOCK + n, n < nflows ? kb : 0);
+    setSn_RXBUF_SIZE(FLOW_SOCK + FLOW_MAX, 0);
+    for (int n = 0; n < FLOW_MAX; n++) setSn_TXBUF_SIZE(FLOW_SOCK + n, 0);
+    setSn_TXBUF_SIZE(FLOW_SOCK + FLOW_MAX, FLOW_TX_KB);
+}
+
+// Subscribe flow n to a multicast group, with map giving the packet channel for each TDM slot
+void flow_open(int n, const uint8_t ip[4], int port, const int8_t *map)
+{
+    Flow &f = flows[n];
+    f.active = false;
+    __dmb();
+    memset(&f.jb, 0, sizeof(f.jb));
+    f.sock = FLOW_SOCK + n;
+    for (int i = 0; i < 4; i++) f.ip[i] = ip[i];
+    f.port = port;
+    for (int c = 0; c < JB_CHANNELS; c++) f.map[c] = map ? map[c] : c;
+    f.seen    = false;
+    f.packets = f.bytes = f.reads = f.last_bytes = f.oversize = 0;
+
+    uint8_t ipc[4] = { ip[0], ip[1], ip[2], ip[3] };
+    uint8_t multicast_mac[6] = {0x01, 0x00, 0x5E, (uint8_t)(ip[1] & 0x7F), ip[2], ip[3]};
+    setSn_MR(f.sock, Sn_MR_UDP);
+    setSn_DHAR(f.sock, multicast_mac);
+    setSn_DIPR(f.sock, ipc);
+    setSn_DPORT(f.sock, port);
+    socket(f.sock, Sn_MR_UDP, port, SF_IO_NONBLOCK | Sn_MR_MULTI);
+
+    __dmb();
+    f.active = true;
+    printf("FLOW %d        %d.%d.%d.%d:%d on socket %d\n", n, ip[0], ip[1], ip[2], ip[3], port, f.sock);
+}
+
+void flow_close(int n)
+{
+    flows[n].active = false;
+    __dmb();
+    close(flows[n].sock);
+}
+
+
+// Parse the whole datagrams in buf, as read from the socket's RX memory, into the flow
+// Returns the bytes used, any part datagram at the end is left for next time
+int flow_parse(Flow &f, const uint8_t *buf, int len, uint64_t now)
+{
+    // Each datagram has the W5500 header of source IP, port and length in front
+    int off = 0;
+    while (off + 8 <= len)
+    {
+        int plen = (buf[off+6] << 8) | buf[off+7];
+        if (off + 8 + plen > len) break;
+        const uint8_t *rtp = buf + off + 8;
+        if (plen >= 12)
+        {
+            uint16_t seq = (rtp[2] << 8) | rtp[3];
+            if (!f.seen) { f.seen = true; f.first = f.highest = seq; }
+            uint32_t ext = f.highest + (int16_t)(seq - (uint16_t)f.highest);
+            if ((int32_t)(ext - f.highest) > 0) f.highest = ext;
+            f.packets++;
+        }
+        jb_write(f.jb, rtp, plen, now, f.map);
+        off += 8 + plen;
+    }
+    return off;
+}
+
+// Read len bytes of flow n's socket in one burst and take the whole datagrams
+int flow_read(int n, int len)
+{
+    static uint8_t buf[FLOW_BUF] __attribute__((aligned(4)));    // Payloads are word aligned for l24_read()
+
+    Flow &f = flows[n];
+    if (len > FLOW_BUF) len = FLOW_BUF;
+    uint16_t ptr = getSn_RX_RD(f.sock);
+    uint32_t addrsel = ((uint32_t)ptr << 8) + (WIZCHIP_RXBUF_BLOCK(f.sock) << 3);
+    uint8_t req[3] = { (uint8_t)(addrsel>>16), (uint8_t)(addrsel>>8), (uint8_t)addrsel };
+
+    WIZCHIP_CRITICAL_ENTER();                                       // Core 1 serves HTTP on the same bus
+    WIZCHIP.CS._select();
+    spi_write_blocking(SPI_PORT, req, 3);
+    spi_read_blocking(SPI_PORT, 0x00, buf, len);
+    WIZCHIP.CS._deselect();
+    WIZCHIP_CRITICAL_EXIT();
+    f.reads++;
+
+    int off = flow_parse(f, buf, len, time_us_64());
+    int big = off == 0 && len >= 8 ? 8 + ((buf[6] << 8) | buf[7]) : 0;
+    if (big > FLOW_BUF)                                             // Never whole in buf, so it would hold up the flow for good
+    {
+        wiz_recv_ignore(f.sock, big);
+        f.oversize++;
+    }
+    else setSn_RX_RD(f.sock, ptr + off);                            // Only whole datagrams, any tail is read again next time
+    setSn_CR(f.sock, Sn_CR_RECV);
+    f.bytes += off;
+    return off;
+}
+
+// Called from the network loop, services the fullest socket
+// Returns the bytes read, or 0 if there was nothing waiting
+int flow_service(void)
+{
+    int best = -1, most = 0;
+    for (int n = 0; n < FLOW_MAX; n++)
+    {
+        if (!flows[n].active) continue;
+        int len = check_rsr(flows[n].sock);
+        if (len > most) { most = len; best = n; }
+    }
+    if (best < 0) return 0;
+    return flow_read(best, most);
+}
+
+
+static inline int32_t __not_in_flash_func(sat_add)(int32_t a, int32_t b)
+{
+    int32_t s = (int32_t)((uint32_t)a + (uint32_t)b);
+    if (((a ^ s) & (b ^ s)) < 0) s = a < 0 ? INT32_MIN : INT32_MAX;
+    return s;
+}
+
+// Called from the ISR, mixes n frames of every active flow into out, which is n frames of JB_CHANNELS
+void __not_in_flash_func(flows_read)(int32_t *out, int n)
+{
+    for (int i = 0; i < n * JB_CHANNELS; i++) out[i] = 0;
+
+    int32_t tmp[8 * JB_CHANNELS];
+    for (int k = 0; k < FLOW_MAX; k++)
+    {
+        Flow &f = flows[k];
+        if (!f.active) continue;
+        jb_read(f.jb, tmp, n);
+        for (int c = 0; c < JB_CHANNELS; c++)
+        {
+            if (f.map[c] < 0) continue;
+            for (int m = 0; m < n; m++) out[m*JB_CHANNELS + c] = sat_add(out[m*JB_CHANNELS + c], tmp[m*JB_CHANNELS + c]);
+        }
+    }
+}
+
+// Called from the ISR when the flows are not played, keeps the jitter buffers moving
+void __not_in_flash_func(flows_discard)(int n)
+{
+    int32_t tmp[8 * JB_CHANNELS];
+    for (int k = 0; k < FLOW_MAX; k++) if (flows[k].active) jb_read(flows[k].jb, tmp, n);
+}
+
+// Jitter buffer depth in frames of the first open flow mapped to TDM slot ch, or 0 with none
+int32_t flow_depth(int ch)
+{
+    for (int k = 0; k < FLOW_MAX; k++)
+        if (flows[k].active && flows[k].map[ch] >= 0) return flows[k].jb.depth;
+    return 0;
+}
+
+// Status of each flow, elapsed_us is the time since the last call for the throughput
+int flows_text(char *buf, uint64_t elapsed_us)
+{
+    char *p = buf;
+    for (int n = 0; n < FLOW_MAX; n++)
+    {
+        Flow &f = flows[n];
+        if (!f.active) continue;
+        uint32_t expected = f.seen ? f.highest - f.first + 1 : 0;
+        int32_t  lost     = (int32_t)(expected - f.packets);
+        uint32_t kbps     = elapsed_us ? (uint32_t)((uint64_t)(f.bytes - f.last_bytes) * 8000 / elapsed_us) : 0;
+        f.last_bytes = f.bytes;
+        p += sprintf(p, "FLOW %d  %d.%d.%d.%d:%-5d  %6lu kbps  packets %8lu  lost %6ld  reads %8lu  oversize %4lu\n",
+                     n, f.ip[0], f.ip[1], f.ip[2], f.ip[3], f.port, (unsigned long)kbps,
+                     (unsigned long)f.packets, (long)lost, (unsigned long)f.reads, (unsigned long)f.oversize);
+        p += jb_text(f.jb, p);
+    }
+    return p - buf;
+}
@@ -0,0 +1,96 @@
+//////////////////////////////////////////////////////////////////////
+// The hardware under the audio path and the network loop
+//
+// The ISR and the network code used to reach into the SDK register structs
+// directly, which tied every line of it to the RP2040.  What they need is
+// small, and it is all here:
+//
+//   timers     hal_timer_us(), the raw 32 bit microsecond count
+//   DMA        hal_dma_ack(), hal_dma_pending() and hal_dma_read_addr() for
+//              the completion interrupt and where the output DMA has got to
+//   PIO        hal_pio_stalls(), the sticky FIFO stall flags, read and cleared
+//   GPIO       hal_gpio_out(), hal_gpio_put() and hal_gpio_get()
+//
+// SPI and sockets already have a seam, being spi_write_blocking() and
+// spi_read_blocking() under the ioLibrary, and the ioLibrary socket calls and
+// register macros above it.  Those names are kept, so flows.h, rtp_tx.h and
+// the rest read the same as the WIZnet examples.
+//
+// This file is the Pico backend, and is all inline.  Building with HAL_LINUX
+// takes tools/host/hal_linux.h instead, where the same calls run off a fake
+// DMA clock, the W5500 is the model in tools/mock_w5500.cpp bridged to UDP
+// sockets on loopback, and the audio comes from and goes to WAV files.  See
+// tools/pipeline_host.cpp.
+//
+
+#pragma once
+#include <stdint.h>
+
+#ifdef HAL_LINUX
+#include "hal_linux.h"
+#else
+
+extern "C" {
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+#include "hardware/gpio.h"
+#include "hardware/timer.h"
+#include "pico/stdlib.h"
+}
+
+
+// Microseconds since boot, low word only so it is one register read
+static inline uint32_t __not_in_flash_func(hal_timer_us)(void)
+{
+    return timer_hw->timerawl;
+}
+
+// Clear DMA interrupt 0 for the channels in mask
+static inline void __not_in_flash_func(hal_dma_ack)(uint32_t mask)
+{
+    dma_hw->ints0 = mask;
+}
+
+// Channels in mask with DMA interrupt 0 raised
+static inline uint32_t __not_in_flash_func(hal_dma_pending)(uint32_t mask)
+{
+    return dma_hw->ints0 & mask;
+}
+
+// Address the channel will read next
+static inline uintptr_t __not_in_flash_func(hal_dma_read_addr)(int ch)
+{
+    return dma_hw->ch[ch].read_addr;
+}
+
+// The channel ch is chained to, which for dma_setup() pairs is the control channel that interrupts
+static inline int hal_dma_chain(int ch)
+{
+    return (dma_hw->ch[ch].ctrl_trig & DMA_CH0_CTRL_TRIG_CHAIN_TO_BITS) >> DMA_CH0_CTRL_TRIG_CHAIN_TO_LSB;
+}
+
+// FDEBUG stall flags of a PIO that are set in bits, cleared once read
+static inline uint32_t __not_in_flash_func(hal_pio_stalls)(pio_hw_t *pio, uint32_t bits)
+{
+    uint32_t v = pio->fdebug & bits;
+    if (v) pio->fdebug = v;                                         // Write 1 to clear
+    return v;
+}
+
+static inline void hal_gpio_out(int pin)
+{
+    gpio_init(pin);
+    gpio_set_dir(pin, GPIO_OUT);
+}
+
+static inline void hal_gpio_put(int pin, bool v)
+{
+    gpio_put(pin, v);
+}
+
+static inline bool hal_gpio_get(int pin)
+{
+    return gpio_get(pin);
+}
+
+#endif
@@ -0,0 +1,196 @@
+//////////////////////////////////////////////////////////////////////
+// Streaming HTTP responses written straight into the W5500 TX buffer
+//
+// The status page used to be built with repeated sprintf(page+strlen(page))
+// into an 8k page and a 3k temporary on the core1 stack, and then the
+// ioLibrary httpServer copied it again.  This writes each part of the page
+// into one small scratch buffer and sends it as it goes, as HTTP/1.1 chunks,
+// so the whole page never exists in RAM and nothing is scanned twice.
+//
+// Text goes in either with http_printf(), or for the existing xxx_text()
+// functions that format into a buffer, by asking for space with
+// http_reserve() and then saying how much was used with http_commit().
+// http_reserve() also gives the room there is, which is passed on to the
+// writer so it stops before the end of the scratch rather than after.  The
+// scratch needs to hold the largest single part, which is a histogram.  When
+// it fills it goes out as one chunk.
+//
+// Each chunk is written into the socket's TX memory with wiz_send_data().
+// A SEND is only issued when the TX memory runs short or at the end, so a
+// page goes out in a few large segments rather than one per chunk.  If the
+// connection drops or stalls for HTTP_TIMEOUT_US the stream is marked failed
+// and the rest of the page is thrown away.
+//
+// http_serve() is the whole server, one call per socket in the main loop.
+// It answers GET / (or /index.html) with the page from the generator and
+// anything else with a 404, and closes the connection after each response.
+//
+
+#pragma once
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+extern "C" {
+#include "wizchip_conf.h"
+#include "socket.h"
+}
+
+#define HTTP_SCRATCH    3072                                        // Largest single part, a 20 row histogram is about 2.5k
+#define HTTP_CHUNK      1024                                        // Send a chunk once this much is waiting
+#define HTTP_LINE       256                                         // Longest single http_printf()
+#define HTTP_TIMEOUT_US 2000000
+
+struct HttpStream
+{
+    int         sock;
+    int         len;                                                // Bytes waiting in buf
+    int         unsent;                                             // Bytes in the TX memory not yet SENT
+    bool        failed;
+    char        buf[HTTP_SCRATCH];
+};
+
+
+// Issue a SEND for what is in the TX memory and wait for the W5500 to take it
+static bool http_send(HttpStream &s)
+{
+    if (s.unsent == 0 || s.failed) return !s.failed;
+    setSn_CR(s.sock, Sn_CR_SEND);
+    while (getSn_CR(s.sock));
+    uint64_t start = time_us_64();
+    while (!(getSn_IR(s.sock) & Sn_IR_SENDOK))
+    {
+        if (getSn_SR(s.sock) != SOCK_ESTABLISHED || (getSn_IR(s.sock) & Sn_IR_TIMEOUT) || time_us_64() - start > HTTP_TIMEOUT_US)
+        {
+            s.failed = true;
+            return false;
+        }
+    }
+    setSn_IR(s.sock, Sn_IR_SENDOK);
+    s.unsent = 0;
+    return true;
+}
+
+// Copy raw bytes into the TX memory, in pieces if there is more than it holds
+static void http_raw(HttpStream &s, const void *data, int len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    while (len > 0 && !s.failed)
+    {
+        int room = getSn_TX_FSR(s.sock);
+        if (room == 0)
+        {
+            if (!http_send(s)) return;                              // Send what is there and wait for it to be acked
+            uint64_t start = time_us_64();
+            while ((room = getSn_TX_FSR(s.sock)) == 0)
+            {
+                if (getSn_SR(s.sock) != SOCK_ESTABLISHED || time_us_64() - start > HTTP_TIMEOUT_US) { s.failed = true; return; }
+            }
+        }
+        int n = len < room ? len : room;
+        wiz_send_data(s.sock, (uint8_t *)p, n);
+        s.unsent += n;
+        p   += n;
+        len -= n;
+    }
+}
+
+// Send whatever is in the scratch as one chunk
+static void http_flush(HttpStream &s)
+{
+    if (s.len == 0) return;
+    char size[12];
+    int  n = sprintf(size, "%X\r\n", s.len);
+    http_raw(s, size, n);
+    http_raw(s, s.buf, s.len);
+    http_raw(s, "\r\n", 2);
+    s.len = 0;
+}
+
+// Space for at least need bytes, which is capped at the scratch size.  room is
+// set to all there is, which the writer must be told and must not go past.
+inline char *http_reserve(HttpStream &s, int need, int &room)
+{
+    if (need > HTTP_SCRATCH) need = HTTP_SCRATCH;
+    if (s.len + need > HTTP_SCRATCH) http_flush(s);
+    room = HTTP_SCRATCH - s.len;
+    return s.buf + s.len;
+}
+
+// Count n bytes written at the last http_reserve(), no more than the room it gave
+inline void http_commit(HttpStream &s, int n)
+{
+    s.len += n;
+    if (s.len >= HTTP_CHUNK) http_flush(s);
+}
+
+inline void http_printf(HttpStream &s, const char *fmt, ...)
+{
+    int   room;
+    char *p = http_reserve(s, HTTP_LINE, room);
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(p, room, fmt, args);
+    va_end(args);
+    http_commit(s, n < 0 ? 0 : n < room ? n : room - 1);
+}
+
+// Status line and headers, the body follows in chunks
+inline void http_begin(HttpStream &s, int sock, int status, const char *type)
+{
+    s.sock = sock;
+    s.len = s.unsent = 0;
+    s.failed = false;
+    char head[160];
+    int  n = sprintf(head, "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n",
+                     status, status == 200 ? "OK" : "Not Found", type);
+    http_raw(s, head, n);
+}
+
+// Last chunk, and send it all.  Returns false if the page did not get out.
+inline bool http_end(HttpStream &s)
+{
+    http_flush(s);
+    http_raw(s, "0\r\n\r\n", 5);
+    return http_send(s);
+}
+
+
+// Run one socket of the server, generate writes the body of the page
+inline void http_serve(HttpStream &s, int sock, int port, void (*generate)(HttpStream &))
+{
+    switch (getSn_SR(sock))
+    {
+        case SOCK_ESTABLISHED:
+        {
+            if (getSn_IR(sock) & Sn_IR_CON) setSn_IR(sock, Sn_IR_CON);
+            int len = getSn_RX_RSR(sock);
+            if (len == 0) break;
+
+            char req[64] = { };                                     // Only the request line matters
+            int  take = len < (int)sizeof(req) - 1 ? len : sizeof(req) - 1;
+            wiz_recv_data(sock, (uint8_t *)req, take);
+            if (len > take) wiz_recv_ignore(sock, len - take);
+            setSn_CR(sock, Sn_CR_RECV);
+            while (getSn_CR(sock));
+
+            bool page = strncmp(req, "GET / ", 6) == 0 || strncmp(req, "GET /index.html ", 16) == 0;
+            http_begin(s, sock, page ? 200 : 404, "text/html");
+            if (page) generate(s);
+            http_end(s);
+            disconnect(sock);
+            break;
+        }
+        case SOCK_CLOSE_WAIT:
+            disconnect(sock);
+            break;
+        case SOCK_INIT:
+            listen(sock);
+            break;
+        case SOCK_CLOSED:
+            socket(sock, Sn_MR_TCP, port, 0x00);
+            break;
+        default:
+            break;
+    }
+}
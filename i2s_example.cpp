@@ -17,8 +17,7 @@ extern "C" {
 }
 
 #include "histogram.hpp"
-#include "upsample.h"
-#include "deinterleave.h"
+#include "hal.h"
 #include "udp_test.h"
 #include "dante_snoop.h"
 
@@ -58,83 +57,22 @@ const uint LED_PIN = PICO_DEFAULT_LED_PIN;
 #define     CLK_PIO         (2*CLK_I2S*64*2*16)                             // PIO execution rate (8 cycles each half bit of 2XI2S)
 #define     CLK_PIO_DIV_N   ((int)(CLK_SYS/CLK_PIO))                        // PIO clock divider integer part
 #define     CLK_PIO_DIV_F   ((int)(((CLK_SYS%CLK_PIO)*256LL+128)/CLK_PIO))  // PIO clock divider fractional part
+#define     ADC_DECIMATE    1                                               // Codec capture rate as a multiple of 48kHz (1, 2 or 4)
+                                                                            // At 2 or 4 only 8/ADC_DECIMATE channels are captured (4 or 2), as
+                                                                            // audio_adc keeps the words per block of 8ch TDM, the rest of audio_tdm is 0
 
 
 // TODO THIS IS WORKING FOR 16 BUT NOT FOR 8 - Some sort of block addressing issue
 
 #define ISR_BLOCK    4           // Number of samples at 48kHz that we lump into each ISR call
+#define MIX_MODE     MIX_IDENTITY // Routing matrix kernel, MIX_IDENTITY costs nothing
+#define NET_RX       0           // Play the received network flows in place of the capture
+#define FLOW_DEVICES { "DESK-Alexa" }   // Dante devices whose multicast flows are received and mixed
+#define LATENCY      LAT_OFF     // Marker for the latency measurement, LAT_IMPULSE or LAT_MLS_MARKER
+#define LATENCY_PATH LAT_OUTPUT, 0, LAT_INPUT, 0    // Where the marker goes out and where it is looked for, with the channel
 
-int32_t   audio_i2s[1][2][ISR_BLOCK][2] __attribute__((aligned(2*2*ISR_BLOCK*4))) = { };    // Single line of normal rate I2S
-int32_t   audio_tdm[1][2][ISR_BLOCK][8] __attribute__((aligned(2*8*ISR_BLOCK*4))) = { };    // One 8 ch TDM injest
-int32_t   audio_out[4][2][ISR_BLOCK][4] __attribute__((aligned(2*4*ISR_BLOCK*4))) = { };    // Outut four lines of double rate I2S
-int32_t   audio_int[1][2][ISR_BLOCK][8] __attribute__((aligned(2*8*ISR_BLOCK*4))) = { };    // Interleaved I2S from the i2s_four_in
-int32_t   audio_buf[8][ISR_BLOCK+FILTER2X_TAPS-1] = { };                                    // 8 channels of FIR buffer
+#include "audio_path.h"                                                                     // Buffers and dma_handler, shared with tools/pipeline_host
 
-Histogram   isr_call("ISR Call Time", 0, 0.0001);
-Histogram   isr_exec("ISR Exec Time", 0, 0.0001);
-
-
-// Called when a full block of data has been written into audio_tdm
-static void dma_handler(void) 
-{
-    dma_hw->ints0 = 1u;                             // No rush for this, and should never re-enter
-    int64_t time = isr_call.time();                 // Mark the ISR call time and setup for
-    isr_exec.start(time);                           // measuring execution time
-
-    int block = (void *)dma_hw->ch[2].read_addr >= &audio_out[0][1][0][0];       // Determine which double buffer to use
-
-    // Deinterleave data from I2S four pin, into the tdm buffer     // About 2us per LRCLK @300MHz
-    for (int n=0; n<ISR_BLOCK; n++)
-    {
-        uint32_t w0 = deinterleave4(audio_int[0][block][n][0]);
-        uint32_t w1 = deinterleave4(audio_int[0][block][n][1]);
-        uint32_t w2 = deinterleave4(audio_int[0][block][n][2]);
-        uint32_t w3 = deinterleave4(audio_int[0][block][n][3]);
-
-        audio_tdm[0][block][n][0] = ((  w0 & 0xFF000000 )    ) + ((  w1 & 0xFF000000 )>>8 ) + ((  w2 & 0xFF000000 )>>16) + ((  w3 & 0xFF000000 )>>24);
-        audio_tdm[0][block][n][2] = ((  w0 & 0x00FF0000 )<<8 ) + ((  w1 & 0x00FF0000 )    ) + ((  w2 & 0x00FF0000 )>>8 ) + ((  w3 & 0x00FF0000 )>>16);
-        audio_tdm[0][block][n][4] = ((  w0 & 0x0000FF00 )<<16) + ((  w1 & 0x0000FF00 )<<8 ) + ((  w2 & 0x0000FF00 )    ) + ((  w3 & 0x0000FF00 )>>8);
-        audio_tdm[0][block][n][6] = ((  w0 & 0x000000FF )<<24) + ((  w1 & 0x000000FF )<<16) + ((  w2 & 0x000000FF )<<8 ) + ((  w3 & 0x000000FF ));
-
-        w0 = deinterleave4(audio_int[0][block][n][4]);
-        w1 = deinterleave4(audio_int[0][block][n][5]);
-        w2 = deinterleave4(audio_int[0][block][n][6]);
-        w3 = deinterleave4(audio_int[0][block][n][7]);
-
-        audio_tdm[0][block][n][1] = ((  w0 & 0xFF000000 )    ) + ((  w1 & 0xFF000000 )>>8 ) + ((  w2 & 0xFF000000 )>>16) + ((  w3 & 0xFF000000 )>>24);
-        audio_tdm[0][block][n][3] = ((  w0 & 0x00FF0000 )<<8 ) + ((  w1 & 0x00FF0000 )    ) + ((  w2 & 0x00FF0000 )>>8 ) + ((  w3 & 0x00FF0000 )>>16);
-        audio_tdm[0][block][n][5] = ((  w0 & 0x0000FF00 )<<16) + ((  w1 & 0x0000FF00 )<<8 ) + ((  w2 & 0x0000FF00 )    ) + ((  w3 & 0x0000FF00 )>>8);
-        audio_tdm[0][block][n][7] = ((  w0 & 0x000000FF )<<24) + ((  w1 & 0x000000FF )<<16) + ((  w2 & 0x000000FF )<<8 ) + ((  w3 & 0x000000FF ));
-    }
-
-    /* Move the single channel I2S data into the TDM buffers
-    {
-        int32_t *pin  = audio_i2s[0][block][0];
-        int32_t *pout = audio_tdm[0][block][0];
-        for (int n = 0; n < ISR_BLOCK; n++)
-        {
-            *pout++ = *pin++;
-            *pout++ = *pin++;
-            pout+=6;
-        }
-    }
-    */
-
-    // Move all of the TDM data into the I2S data buffers and filter    // About 6us per LRCLK at @300MHz
-    for (int n = 0; n < 8; n++)
-    {
-        int32_t *pbuf = audio_buf[n];
-        int32_t *pin  = &audio_tdm[0][block][0][n];
-        for (int m=0; m<FILTER2X_TAPS-1; m++) pbuf[m]                 = pbuf[m+ISR_BLOCK];  // Move the FIR buffer along
-        for (int m=0; m<ISR_BLOCK; m++)       pbuf[m+FILTER2X_TAPS-1] = pin[8*m] >> 8;      // Scale down and add new data
-        filter2x(pbuf+FILTER2X_TAPS-1, &audio_out[n/2][block][0][n%2], ISR_BLOCK, 2);       // Filter and place into 2X buffer
-        //for (int m=0; m<ISR_BLOCK; m++) audio_out[n/2][block][m][n%2] = pin[8*m];
-    }        
-    //audio_out[0][0][0][0] = 0xFFFFFFFF;           // Debugging marker
-    isr_exec.time();
-    
-
-}
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Create a DMA pair to manage a double buffered transfer
@@ -180,83 +118,77 @@ int dma_setup(pio_hw_t *pio, int sm, dma_dir_t dir, int block, int32_t *data, bo
 }
 
 
-#define FLASH_TARGET_OFFSET (1792*1024)                                                         //++ Starting Flash Storage location after 1.8MB ( of the 2MB )
-const uint8_t *flash_target_contents = (const uint8_t *) (XIP_BASE + FLASH_TARGET_OFFSET);      //++ Pointer pointing at the Flash Address Location
-
-void core1(void);
-
-int main()
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Erase and write one sector of flash without stopping the audio
+//
+// The usual way is to disable all interrupts, which holds off the ISR for the whole erase (tens of ms).
+// Instead only the other interrupts are masked, as their handlers are in flash, and the DMA interrupt is
+// left running since all of the ISR is in RAM.  Core 1 is paused in its lockout handler if it has set one
+// up.  Call from core 0 only, as that is where the ISR runs and flash_busy is read.
+//
+void flash_update(uint32_t offset, const uint8_t *data, size_t len)
 {
+    uint32_t mask = 0;
+    for (uint n = 0; n < 32; n++) if (n != DMA_IRQ_0 && irq_is_enabled(n)) mask |= 1u << n;
+
+    bool core1 = multicore_lockout_victim_is_initialized(1);
+    if (core1) multicore_lockout_start_blocking();
+    irq_set_mask_enabled(mask, false);
+    flash_busy = true;
+    __dmb();
+
+    flash_range_erase(offset, FLASH_SECTOR_SIZE);
+    flash_range_program(offset, data, len);
+
+    __dmb();
+    flash_busy = false;
+    irq_set_mask_enabled(mask, true);
+    if (core1) multicore_lockout_end_blocking();
+}
 
-    set_sys_clock_khz(133000,false);
-    stdio_init_all();                                                                           //++ Initialize rp2040
-    sleep_ms(10);
-
-    uint32_t flash_data[FLASH_PAGE_SIZE] = {};
-    uint32_t foffset = (2044*1024);
-    typedef struct 
-    {
-        uint32_t    magic;
-        uint32_t    loads;
-    } flash_header_t;
-    flash_header_t *local;
-    local = (flash_header_t *)flash_data;
-
-    memcpy(flash_data,(const void*)(XIP_BASE + foffset),sizeof(flash_header_t));    
-    if (local->magic != 0x12345678) memset(flash_data,0,sizeof(flash_header_t));
-    local->magic = 0x12345678;
-    local->loads++;
-    
-    uint32_t interrupts = save_and_disable_interrupts();
-    flash_range_erase(foffset, FLASH_SECTOR_SIZE);
-    restore_interrupts(interrupts);   
-
-    sleep_ms(100);
-
-    interrupts = save_and_disable_interrupts();
-    flash_range_program(foffset,(const uint8_t *)flash_data, FLASH_PAGE_SIZE);
-    restore_interrupts(interrupts);   
-
-
-    vreg_set_voltage(REG_VOLTAGE);
-    stdio_init_all();
-    
-    uint vco, postdiv1, postdiv2;
-    int ret = check_sys_clock_khz(CLK_SYS/1000, &vco, &postdiv1, &postdiv2);
-    printf("\n\nCHECKING CLOCK    %10ld %d %d %d %d\n", CLK_SYS, ret, vco, postdiv1, postdiv2);
-    sleep_ms(100);
-
-    set_sys_clock_khz(CLK_SYS/1000, false);
-    uint32_t freq = clock_get_hz(clk_sys);
-    clock_configure(clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLK_SYS, freq, freq);        // Allow overclock of PERI
-    stdio_init_all();
 
-    sleep_ms(100);
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// How much of the core 0 stack has never been used
+//
+// The stack is the top 2k of scratch Y (PICO_STACK_SIZE), from __StackBottom to __StackTop, with the FIR
+// state and the deinterleave table below it, and the ISR runs on it as well as main().  The build sets
+// PICO_USE_STACK_GUARDS, so going past __StackBottom faults rather than writing over those, and the
+// guard takes the first 32 bytes.  stack_paint() fills the rest below the caller, early in main(), and
+// stack_spare() counts what is still untouched from the bottom up, for the core 1 page.
+//
+#define STACK_PAINT 0x5A5A5A5Au
 
-//    multicore_launch_core1(&core1);
+static uint32_t *stack_floor(void)
+{
+    extern uint32_t __StackBottom;
+    return (uint32_t *)(((uintptr_t)&__StackBottom + 63) & ~31u);     // Above the 32 byte guard
+}
 
-    printf("\n\n\n\n");
-    printf("BOOT NUMBER                 %10ld\n",local->loads);
-    printf("SYSTEM CLOCK DESIRED:       %10ld\n", CLK_SYS);
-    printf("SYSTEM CLOCK ACTUAL:        %10ld\n\n", clock_get_hz(clk_sys));
+static void __attribute__((noinline)) stack_paint(void)
+{
+    uint32_t *sp = (uint32_t *)__builtin_frame_address(0) - 16;
+    for (uint32_t *p = stack_floor(); p < sp; p++) *p = STACK_PAINT;
+}
 
-    // Init GPIO LED
-    gpio_init(LED_PIN);
-    gpio_set_dir(LED_PIN, GPIO_OUT);
+uint32_t stack_spare(void)
+{
+    uint32_t *p = stack_floor();
+    while (*p == STACK_PAINT) p++;
+    return (p - stack_floor()) * 4;
+}
 
-    dante_test();
-    for (int n=0; n<64; n++)
-    {
-        if (strcmp(dante_devices[n].name,"DESK-Alexa")==0)
-        {
-            printf("\n\nFOUND ALEXA\n");
-            printf("ELAPSED TIME %10lld us\n\n",time_us_64());
-            udp_test(dante_devices[n].mcast_ip, dante_devices[n].mcast_port);
-        }
-    }
 
-/*
+#define FLASH_TARGET_OFFSET (1792*1024)                                                         //++ Starting Flash Storage location after 1.8MB ( of the 2MB )
+const uint8_t *flash_target_contents = (const uint8_t *) (XIP_BASE + FLASH_TARGET_OFFSET);      //++ Pointer pointing at the Flash Address Location
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// The I2S in and double rate out, with their DMAs and the ISR
+//
+// The deadline monitor is armed just before the DMA interrupt is enabled, as dma_handler() acks the
+// interrupt deadline_init() finds and picks its block from the output channel it watches.
+//
+void audio_start(void)
+{
     // Setting up a PIO to be a slave at 48kHz, and then to double this and create a
     // clock suitable for 96kHz.  
 
@@ -284,8 +216,6 @@ int main()
     printf("PIO CLOCK DIVIDER:        %2d + %3d/256\n", CLK_PIO_DIV_N, CLK_PIO_DIV_F);
     printf("PIO CLOCK ACTUAL:           %10lld\n", (int64_t)(clock_get_hz(clk_sys) / ((float)CLK_PIO_DIV_N + ((float)CLK_PIO_DIV_F / 256.0f))));
     
-    for (int n=0; n<10; n++) dma_claim_unused_channel(true);
-
     // PIO0 is responsible for the input I2S or TDM
     //uint offset = pio_add_program (pio0, &i2s_in_program);
     //i2s_in_init(pio0, 0, offset, I2S_LRCLK, I2S_DI0, CLK_PIO_DIV_N, CLK_PIO_DIV_F);
@@ -295,10 +225,18 @@ int main()
     //tdm_in_init(pio0, 0, offset, I2S_LRCLK, I2S_DI0, CLK_PIO_DIV_N, CLK_PIO_DIV_F);
     //dma_setup  (0, pio0, 0, IN,  8*ISR_BLOCK, (int32_t *)audio_tdm[0],  true);          // Interrupt each time receive block is done
 
+    // For ADC_DECIMATE the capture lands in audio_adc, needing a tdm_in variant with ADC_CHANNELS words per frame
+    // at the codec rate.  There is none yet, so the decimators only run in tools/decimate_bench for now, and
+    // rather than decimate an audio_adc nothing writes, the board does not build with them.
+    static_assert(ADC_DECIMATE == 1, "Nothing captures into audio_adc yet, see audio_start()");
+    //dma_setup  (pio0, 0, IN,  8*ISR_BLOCK, (int32_t *)audio_adc[0],  true);             // Interrupt each time receive block is done
+
     uint offset = pio_add_program (pio0, &i2s_four_in_program);
     i2s_four_in_init(pio0, 0, offset, I2S_LRCLK, I2S_DI0, CLK_PIO_DIV_N, CLK_PIO_DIV_F);
     int dma = dma_setup  (pio0, 0, IN,  8*ISR_BLOCK, (int32_t *)audio_int[0],  true);          // Interrupt each time receive block is done
     printf("DMA FOR INPUT:              %10d\n", dma);
+    int dma_in = dma;
+    uint32_t start = 1u << hal_dma_chain(dma);                                              // The control channels, which start the data ones
 
     // PIO1 is responsible for the output double rate I2S
     offset = pio_add_program  (pio1, &i2s_double_out_program);
@@ -309,25 +247,89 @@ int main()
 
     dma = dma_setup(pio1, 0, OUT, 4*ISR_BLOCK, (int32_t *)audio_out[0]);                   // Dual data and control DMAs
     printf("DMA FOR INPUT0:             %10d\n", dma);
+    start |= 1u << hal_dma_chain(dma);
+    int dma_out = dma;
     dma = dma_setup(pio1, 1, OUT, 4*ISR_BLOCK, (int32_t *)audio_out[1]);
     printf("DMA FOR INPUT1:             %10d\n", dma);
+    start |= 1u << hal_dma_chain(dma);
     dma = dma_setup(pio1, 2, OUT, 4*ISR_BLOCK, (int32_t *)audio_out[2]);
     printf("DMA FOR INPUT2:             %10d\n", dma);
+    start |= 1u << hal_dma_chain(dma);
     dma = dma_setup(pio1, 3, OUT, 4*ISR_BLOCK, (int32_t *)audio_out[3]);
     printf("DMA FOR INPUT3:             %10d\n", dma);
+    start |= 1u << hal_dma_chain(dma);
 
-
-//    multicore_launch_core1(&core1);
-
+    deadline_init(deadline, pio0, 0, dma_in, pio1, 0b1111, dma_out, audio_out[0][0][0], 4*ISR_BLOCK);   // Line 0 stands for all four outputs
     irq_set_exclusive_handler(DMA_IRQ_0, dma_handler);
     irq_set_enabled(DMA_IRQ_0, true);
     irq_set_priority(DMA_IRQ_0, 0);                     // Make this the highest priority
-    dma_start_channel_mask(0b1010101010);               // Start all of the data DMAs
+    dma_start_channel_mask(start);                      // Start all of the data DMAs
 
     while ( gpio_get(I2S_LRCLK));                       // Wait for LR Clk to be low
     while (!gpio_get(I2S_LRCLK));                       // Wait for a rising edge - machine sync on first fall
     pio_enable_sm_mask_in_sync(pio0_hw, 0b0001);
-    pio_enable_sm_mask_in_sync(pio1_hw, 0b1111);   
+    pio_enable_sm_mask_in_sync(pio1_hw, 0b1111);
+}
+
+
+void core1(void);
+
+int main()
+{
+    stack_paint();
+    set_sys_clock_khz(133000,false);
+    stdio_init_all();                                                                           //++ Initialize rp2040
+    sleep_ms(10);
+
+    static uint32_t flash_data[FLASH_PAGE_SIZE];                                                // Static, as the core 0 stack is only 2k
+    uint32_t foffset = (2044*1024);
+    typedef struct 
+    {
+        uint32_t    magic;
+        uint32_t    loads;
+    } flash_header_t;
+    flash_header_t *local;
+    local = (flash_header_t *)flash_data;
+
+    memcpy(flash_data,(const void*)(XIP_BASE + foffset),sizeof(flash_header_t));    
+    if (local->magic != 0x12345678) memset(flash_data,0,sizeof(flash_header_t));
+    local->magic = 0x12345678;
+    local->loads++;
+    
+    flash_update(foffset, (const uint8_t *)flash_data, FLASH_PAGE_SIZE);
+
+
+    vreg_set_voltage(REG_VOLTAGE);
+    stdio_init_all();
+    
+    uint vco, postdiv1, postdiv2;
+    int ret = check_sys_clock_khz(CLK_SYS/1000, &vco, &postdiv1, &postdiv2);
+    printf("\n\nCHECKING CLOCK    %10ld %d %d %d %d\n", CLK_SYS, ret, vco, postdiv1, postdiv2);
+    sleep_ms(100);
+
+    set_sys_clock_khz(CLK_SYS/1000, false);
+    uint32_t freq = clock_get_hz(clk_sys);
+    clock_configure(clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLK_SYS, freq, freq);        // Allow overclock of PERI
+    stdio_init_all();
+
+    sleep_ms(100);
+
+    printf("\n\n\n\n");
+    printf("BOOT NUMBER                 %10ld\n",local->loads);
+    printf("SYSTEM CLOCK DESIRED:       %10ld\n", CLK_SYS);
+    printf("SYSTEM CLOCK ACTUAL:        %10ld\n\n", clock_get_hz(clk_sys));
+
+    // Init GPIO LED
+    hal_gpio_out(LED_PIN);
+
+    int nflows = pipeline_start();                      // Discovery, the flows, RTP transmit and telemetry
+    multicore_launch_core1(&core1);                     // The status page, now the W5500 and the flows are set up
+    audio_start();
+    if (!nflows) printf("NO FLOWS\n");
+    udp_test();                                         // The network loop, which also runs the latency search, so with no flows too
+
+/*
+
 
     
     
@@ -384,9 +386,9 @@ int main()
     char str[8000];
     while(1)
     {
-        gpio_put(LED_PIN, 1);
+        hal_gpio_put(LED_PIN, 1);
         sleep_ms(2300);
-        gpio_put(LED_PIN, 0);
+        hal_gpio_put(LED_PIN, 0);
         sleep_ms(2299);
     
         printf("Time passed %lld\n",isr_call.now()-time);
@@ -0,0 +1,320 @@
+//////////////////////////////////////////////////////////////////////
+// Jitter buffer with loss concealment for an incoming L24 RTP stream
+//
+// Packets are held in slots by RTP sequence number, so they can arrive in
+// any order.  The network loop converts each packet to full scale int32 as it
+// writes it in with jb_write(), and the ISR reads whole blocks of frames out
+// with jb_read(), straight into the TDM layout that dma_handler works on.
+// Both run on core 0, so jb_write() can be interrupted by the ISR at any time
+// and a slot is only marked full once all of it has been written.
+//
+// The arrival jitter is measured as in RFC3550, from the difference in
+// transit time between packets, and smoothed by 1/16.  The target depth is
+// one packet plus four times that jitter, or the largest recent spike if
+// that is bigger.  Spikes are taken at once and decay over about a quarter
+// second, so a busy switch raises the latency straight away and it comes
+// back down slowly once things settle.
+//
+// Each JB_WINDOW packets the smallest depth seen is compared to the target.
+// If there is too much in hand the ISR drops one block with a crossfade, and
+// if there is too little it repeats the last block backwards then forwards,
+// which keeps the waveform continuous.  This also takes up the slow drift
+// between the sender's clock and ours.
+//
+// Playout starts once the target is in hand, which for a new stream is a
+// cautious two packets of spike on top of the one packet.
+//
+// When a packet has not arrived by the time it is due it is counted as missed
+// and the last good packet is played again, alternately backwards and
+// forwards so there are no steps at the joins, fading to silence over
+// JB_FADE packets.  The next good packet is crossfaded in over whatever is
+// left of that, over one packet with the two gains adding up to no more
+// than unity, so the sum cannot overflow.  A packet that turns up after its time is counted as late
+// and dropped, and asks for a block of extra depth straight away.  Lost,
+// from jb_lost(), is the missed packets that never turned up, so late and
+// lost add up to missed and each packet is in one or the other.
+//
+// Checked with tools/pcap_replay on a capture made with --make, one flow of
+// 2 channels, 300us mean exponential jitter, 1% loss and a 50ppm fast
+// sender, over 10s.  The packets the JB counts as lost are the ones dropped
+// from the capture, the target settles at about 3ms, and 0.15% of packets
+// are late.
+//
+// jb_write() takes an optional map from buffer channels to packet channels,
+// so a stream with more or fewer channels can be picked from.  The frame
+// count per packet is fixed at JB_FRAMES and the channel count is taken from
+// the payload size.
+//
+// Counters for depth, late, lost and concealed are kept for the status
+// output, and jb_text() formats them.
+//
+
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "l24.h"
+
+#define JB_SLOTS        8                                           // Packets held, must be a power of two
+#define JB_FRAMES       48                                          // Frames per packet, 48 for 1ms
+#define JB_CHANNELS     8
+#define JB_FADE         2                                           // Packets to fade out over when concealing
+#define JB_WINDOW       256                                         // Packets between depth adjustments
+#define JB_MAX          ((JB_SLOTS - 3) * JB_FRAMES)                 // Deepest target, leaves room for the concealment history
+
+struct JbSlot
+{
+    volatile uint32_t   pkt;                                        // Extended sequence number held
+    volatile bool       full;
+    int32_t             audio[JB_FRAMES][JB_CHANNELS];
+};
+
+struct Jitter
+{
+    JbSlot              slot[JB_SLOTS];
+
+    // Playout, owned by the ISR while running
+    volatile bool       running;
+    uint32_t            play_pkt;
+    int                 play_frame;
+    volatile uint32_t   play;                                       // play_pkt*JB_FRAMES + play_frame, for the network side
+    bool                good;                                       // Current packet is real audio
+    int                 conceal;                                    // Packets concealed in a row
+    uint32_t            last_good;
+    int32_t             gain;                                       // Fade gain, 1<<23 is unity
+    int32_t             fade;                                       // Gain of the concealment when a good packet came, faded out under it
+    int                 insert;                                     // Blocks left to insert
+    int32_t             prev[8][JB_CHANNELS];                       // Last block played, for inserting
+    volatile int        adjust;                                     // Set by the network side, +1 insert or -1 drop a block
+
+    // Arrival, owned by the network loop
+    bool                started;
+    bool                primed;                                     // Playout has been set up, waiting for depth or running
+    uint32_t            newest;
+    int32_t             transit;
+    int32_t             jitter16;                                   // RFC3550 jitter in frames, times 16
+    int32_t             spike16;
+    int32_t             target;                                     // Depth to aim for in frames
+    int32_t             low;                                        // Lowest depth this window
+    int                 window;
+    int                 late_run;                                   // Late packets in a row, the sender has jumped back
+
+    volatile int32_t    depth;                                      // Lowest depth over the last window
+    uint32_t            first;                                      // Packet playout started from
+    volatile uint32_t   received, late, missed, concealed, overflows, slips, bad;
+};
+
+
+// Fetch n frames from the current play position, concealing if the packet is missing
+static inline void __not_in_flash_func(jb_fetch)(Jitter &jb, int32_t (*out)[JB_CHANNELS], int n)
+{
+    JbSlot &s = jb.slot[jb.play_pkt % JB_SLOTS];
+    if (jb.play_frame == 0)
+    {
+        bool good = s.full && s.pkt == jb.play_pkt;
+        if (good && jb.conceal)                                     // Crossfade out of the concealment
+        {
+            jb.fade = jb.conceal <= JB_FADE ? jb.gain : 0;
+            jb.gain = 0;
+            jb.conceal++;
+        }
+        else if (good) { jb.fade = 0; jb.gain = 1 << 23; jb.conceal = 0; }
+        else           { jb.conceal++; jb.missed++; }
+        jb.good = good;
+    }
+
+    const JbSlot &h = jb.slot[jb.last_good % JB_SLOTS];
+    bool back = jb.conceal & 1;                                     // Backwards first, so it joins up with the end of the last packet
+    for (int m = 0; m < n; m++)
+    {
+        int f = jb.play_frame + m;
+        const int32_t *old = h.audio[back ? JB_FRAMES - 1 - f : f];
+        if (jb.good)
+        {
+            int32_t g = jb.gain >> 16;
+            if (g == 128) for (int c = 0; c < JB_CHANNELS; c++) out[m][c] = s.audio[f][c];
+            else
+            {
+                int32_t k = ((jb.fade >> 16) * (128 - g)) >> 7;       // Complementary to g, scaled by where the fade out had got to
+                for (int c = 0; c < JB_CHANNELS; c++) out[m][c] = (((s.audio[f][c] >> 8) * g) << 1) + (((old[c] >> 8) * k) << 1);
+                jb.gain += (1 << 23) / JB_FRAMES;
+            }
+        }
+        else
+        {
+            int32_t g = jb.gain >> 16;
+            for (int c = 0; c < JB_CHANNELS; c++) out[m][c] = ((old[c] >> 8) * g) << 1;
+            jb.gain -= (1 << 23) / (JB_FADE * JB_FRAMES);
+            if (jb.gain < 0) jb.gain = 0;
+        }
+    }
+    if (!jb.good) jb.concealed += n;
+
+    jb.play_frame += n;
+    if (jb.play_frame == JB_FRAMES)
+    {
+        if (jb.good) { jb.last_good = jb.play_pkt; jb.conceal = 0; jb.gain = 1 << 23; }
+        jb.play_pkt++;
+        jb.play_frame = 0;
+    }
+    jb.play = jb.play_pkt * JB_FRAMES + jb.play_frame;
+}
+
+// Called from the ISR for n frames of JB_CHANNELS, n must be a power of two up to 8
+void __not_in_flash_func(jb_read)(Jitter &jb, int32_t *dst, int n)
+{
+    int32_t (*out)[JB_CHANNELS] = (int32_t (*)[JB_CHANNELS])dst;
+    if (!jb.running)
+    {
+        for (int m = 0; m < n; m++) for (int c = 0; c < JB_CHANNELS; c++) out[m][c] = 0;
+        return;
+    }
+
+    if (jb.adjust > 0 && !jb.insert) { jb.insert = 2; jb.slips++; }
+    if (jb.insert)
+    {
+        bool back = jb.insert == 2;                                 // Backwards then forwards, so both joins line up
+        for (int m = 0; m < n; m++) for (int c = 0; c < JB_CHANNELS; c++) out[m][c] = jb.prev[back ? n - 1 - m : m][c];
+        if (--jb.insert == 0) jb.adjust = 0;
+        return;
+    }
+
+    jb_fetch(jb, out, n);
+    if (jb.adjust < 0)
+    {
+        int32_t next[8][JB_CHANNELS];                               // Crossfade into the block after, dropping one
+        jb_fetch(jb, next, n);
+        int sh = 0;
+        while ((1 << sh) < n) sh++;                                 // No divide, that would be a call into flash
+        for (int m = 0; m < n; m++)
+        {
+            int32_t g = (m << 7) >> sh;
+            for (int c = 0; c < JB_CHANNELS; c++) out[m][c] = (((out[m][c] >> 8) * (128 - g)) << 1) + (((next[m][c] >> 8) * g) << 1);
+        }
+        jb.adjust = 0;
+        jb.slips++;
+    }
+    for (int m = 0; m < n; m++) for (int c = 0; c < JB_CHANNELS; c++) jb.prev[m][c] = out[m][c];
+}
+
+
+// Called from the network loop with one RTP packet, and the arrival time in us
+// map[c] is the packet channel for buffer channel c, or -1 for silence, or nullptr for one to one
+void jb_write(Jitter &jb, const uint8_t *rtp, int len, uint64_t now_us, const int8_t *map = nullptr)
+{
+    if (len < 12 || (rtp[0] & 0xC0) != 0x80) { jb.bad++; return; }
+    int hlen = 12 + 4 * (rtp[0] & 0x0F);                            // CSRCs
+    if ((rtp[0] & 0x10) && len >= hlen + 4) hlen += 4 + 4 * ((rtp[hlen+2] << 8) | rtp[hlen+3]);  // Header extension
+    if (rtp[0] & 0x20) len -= rtp[len-1];                           // Padding
+    int plen = len - hlen;
+    int nch  = plen / (3 * JB_FRAMES);
+    if (plen <= 0 || nch * 3 * JB_FRAMES != plen) { jb.bad++; return; }
+
+    uint16_t seq = (rtp[2] << 8) | rtp[3];
+    uint32_t ts  = (rtp[4] << 24) | (rtp[5] << 16) | (rtp[6] << 8) | rtp[7];
+    const uint8_t *payload = rtp + hlen;
+    jb.received++;
+
+    // Arrival jitter in frames, from the change in transit time
+    int32_t transit = (int32_t)((uint32_t)(now_us * 6 / 125) - ts);
+    if (!jb.started) { jb.started = true; jb.transit = transit; }
+    int32_t d = transit - jb.transit;
+    jb.transit = transit;
+    if (d < 0) d = -d;
+    if (d < 48000)                                                  // Ignore a restart of the sender
+    {
+        jb.jitter16 += d - ((jb.jitter16 + 8) >> 4);
+        if (16 * d > jb.spike16) jb.spike16 = 16 * d;
+        else                     jb.spike16 -= (jb.spike16 + 255) >> 8;
+    }
+
+    uint32_t pkt = jb.primed ? jb.newest + (int16_t)(seq - (uint16_t)jb.newest) : seq;
+
+    if (jb.running && (int32_t)(pkt - jb.play_pkt) >= 2 * JB_SLOTS) { jb.overflows++; jb.running = jb.primed = false; }
+    if (jb.running && jb.late_run > JB_SLOTS)                       { jb.running = jb.primed = false; }
+    if (!jb.primed)                                                 // Start playout from this packet
+    {
+        for (int s = 0; s < JB_SLOTS; s++) jb.slot[s].full = false;
+        jb.newest     = pkt;
+        jb.play_pkt   = pkt;
+        jb.play_frame = 0;
+        jb.play       = pkt * JB_FRAMES;
+        jb.last_good  = pkt - 1;
+        jb.gain       = 0;
+        jb.conceal    = 0;
+        jb.insert     = 0;
+        jb.adjust     = 0;
+        jb.late_run   = 0;
+        jb.window     = 0;
+        jb.spike16    = 16 * 2 * JB_FRAMES;                         // Start cautious and come down from there
+        jb.first      = pkt;
+        jb.primed     = true;
+    }
+    int32_t target = 4 * (jb.jitter16 >> 4);
+    if (target < (jb.spike16 >> 4)) target = jb.spike16 >> 4;
+    target += JB_FRAMES;
+    jb.target = target > JB_MAX ? JB_MAX : target;
+
+    if ((int32_t)(pkt * JB_FRAMES - jb.play) < 0)
+    {
+        const JbSlot &s = jb.slot[pkt % JB_SLOTS];
+        bool played = s.full && s.pkt == pkt;                       // A duplicate of one that was played
+        if (!played && (int32_t)(pkt - jb.first) >= 0) jb.late++;   // Was counted as missed when it was due
+        jb.late_run++;
+        int32_t depth = (int32_t)((jb.newest + 1) * JB_FRAMES - jb.play);
+        if (jb.running && !jb.adjust && depth < jb.target) jb.adjust = 1;   // Too shallow, so add some depth now
+        return;
+    }
+    jb.late_run = 0;
+    if ((int32_t)(pkt - jb.play_pkt) >= JB_SLOTS - 2)              // No room, so drop it and catch up a little
+    {
+        jb.overflows++;
+        if (jb.running && !jb.adjust) jb.adjust = -1;
+        return;
+    }
+
+    JbSlot &s = jb.slot[pkt % JB_SLOTS];
+    s.full = false;
+    __dmb();
+    l24_read(s.audio[0], JB_CHANNELS, payload, nch, map, JB_FRAMES, 0);
+    s.pkt = pkt;
+    __dmb();
+    s.full = true;
+    if ((int32_t)(pkt - jb.newest) > 0) jb.newest = pkt;
+
+    // Depth is what is in hand beyond the play position
+    int32_t depth = (int32_t)((jb.newest + 1) * JB_FRAMES - jb.play);
+    if (!jb.running)
+    {
+        if (depth >= jb.target) { jb.low = depth; jb.window = 0; __dmb(); jb.running = true; }
+        return;
+    }
+    if (depth < jb.low) jb.low = depth;
+    if (++jb.window >= JB_WINDOW)
+    {
+        jb.depth = jb.low;
+        if (!jb.adjust)
+        {
+            if (jb.low > jb.target + JB_FRAMES / 2) jb.adjust = -1;
+            else if (jb.low < jb.target - JB_FRAMES / 2) jb.adjust = 1;
+        }
+        jb.low    = depth;
+        jb.window = 0;
+    }
+}
+
+// Packets that were due and never turned up
+inline uint32_t jb_lost(const Jitter &jb)
+{
+    uint32_t missed = jb.missed, late = jb.late;
+    return missed > late ? missed - late : 0;
+}
+
+// Status line for the network loop or the stats page
+int jb_text(const Jitter &jb, char *buf)
+{
+    return sprintf(buf, "JITTER BUFFER depth %4ld target %4ld jitter %4ld  rx %8lu late %6lu lost %6lu concealed %8lu over %4lu slips %6lu bad %4lu\n",
+                   (long)jb.depth, (long)jb.target, (long)(jb.jitter16 >> 4),
+                   (unsigned long)jb.received, (unsigned long)jb.late, (unsigned long)jb_lost(jb), (unsigned long)jb.concealed,
+                   (unsigned long)jb.overflows, (unsigned long)jb.slips, (unsigned long)jb.bad);
+}
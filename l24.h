@@ -0,0 +1,138 @@
+//////////////////////////////////////////////////////////////////////
+// Conversion between AES67 L24 payloads and the int32 words of audio_tdm
+//
+// L24 is big endian 24 bit, packed three bytes to a sample.  audio_tdm and
+// the jitter buffer hold left justified int32, so the obvious loop is three
+// byte loads, shifts and ors per sample each way, which on the M0+ costs
+// about as much as filter2x does.  Four samples are exactly three words, so
+// these work a word at a time.  Each group of four is three loads, three
+// REVs for the byte order and a handful of shifts, masks and ors, then four
+// stores.  The other way is four loads and three stores.
+//
+// The M0+ faults on an unaligned word, so the samples are taken one at a
+// time until the packed side is on a word boundary, which is never more
+// than three, and then the rest in fours with the odd ones after.  Packets
+// from the W5500 and the RTP TX slots are laid out so that this is normally
+// aligned from the start.
+//
+// The shift is folded in.  l24_unpack() shifts right (arithmetic) so 8 gives
+// 24 bit words as filter2x wants them, and l24_pack() shifts left so 8 takes
+// 24 bit words.  0 is left justified full scale, as audio_tdm is.
+//
+// l24_read() and l24_write() handle whole frames, picking channels out of a
+// packet with a map and working on runs of channels that are next to each
+// other.  When the channels are all in order the whole payload is one run.
+//
+// tools/l24_bench checks these bit for bit against the byte loop over all
+// the alignments, lengths, shifts and maps, and times the two.
+//
+
+#pragma once
+#include <stdint.h>
+#include "pico/stdlib.h"
+
+#define L24_MAX_CHANNELS    16                                      // Channels in a row for l24_read()
+
+typedef uint32_t __attribute__((may_alias)) l24_word;
+
+
+// One sample each way, the byte loop, forced inline so the RAM functions below never call into flash
+static inline __attribute__((always_inline)) int32_t l24_get(const uint8_t *p, int shift)
+{
+    return (int32_t)(((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8)) >> shift;
+}
+
+static inline __attribute__((always_inline)) void l24_put(uint8_t *p, int32_t v, int shift)
+{
+    uint32_t s = (uint32_t)v << shift;
+    p[0] = s >> 24;
+    p[1] = s >> 16;
+    p[2] = s >> 8;
+}
+
+
+// n packed samples from src into dst, shifted right
+static inline void __not_in_flash_func(l24_unpack)(int32_t *dst, const uint8_t *src, int n, int shift)
+{
+    for (; n > 0 && ((uintptr_t)src & 3); n--, src += 3) *dst++ = l24_get(src, shift);
+
+    const l24_word *w = (const l24_word *)src;
+    for (; n >= 4; n -= 4, w += 3, dst += 4)
+    {
+        uint32_t a = __builtin_bswap32(w[0]);                       // s0 s0 s0 s1
+        uint32_t b = __builtin_bswap32(w[1]);                       // s1 s1 s2 s2
+        uint32_t c = __builtin_bswap32(w[2]);                       // s2 s3 s3 s3
+        dst[0] = (int32_t)(a & 0xFFFFFF00) >> shift;
+        dst[1] = (int32_t)((a << 24) | ((b >> 8) & 0x00FFFF00)) >> shift;
+        dst[2] = (int32_t)((b << 16) | ((c >> 16) & 0x0000FF00)) >> shift;
+        dst[3] = (int32_t)(c << 8) >> shift;
+    }
+
+    for (src = (const uint8_t *)w; n > 0; n--, src += 3) *dst++ = l24_get(src, shift);
+}
+
+// n samples from src packed into dst, shifted left
+static inline void __not_in_flash_func(l24_pack)(uint8_t *dst, const int32_t *src, int n, int shift)
+{
+    for (; n > 0 && ((uintptr_t)dst & 3); n--, dst += 3) l24_put(dst, *src++, shift);
+
+    l24_word *w = (l24_word *)dst;
+    for (; n >= 4; n -= 4, w += 3, src += 4)
+    {
+        uint32_t a = (uint32_t)src[0] << shift;
+        uint32_t b = (uint32_t)src[1] << shift;
+        uint32_t c = (uint32_t)src[2] << shift;
+        uint32_t d = (uint32_t)src[3] << shift;
+        w[0] = __builtin_bswap32((a & 0xFFFFFF00) | (b >> 24));
+        w[1] = __builtin_bswap32(((b << 8) & 0xFFFF0000) | (c >> 16));
+        w[2] = __builtin_bswap32(((c << 16) & 0xFF000000) | (d >> 8));
+    }
+
+    for (dst = (uint8_t *)w; n > 0; n--, dst += 3) l24_put(dst, *src++, shift);
+}
+
+
+// Frames of a payload with nch channels into rows of dst_ch words.  map gives the payload
+// channel for each row channel, or -1 for silence, and nullptr takes them in order.
+void l24_read(int32_t *dst, int dst_ch, const uint8_t *payload, int nch, const int8_t *map, int frames, int shift)
+{
+    if (dst_ch > L24_MAX_CHANNELS) dst_ch = L24_MAX_CHANNELS;
+
+    // Runs of row channels whose payload channels follow on
+    int at[L24_MAX_CHANNELS], from[L24_MAX_CHANNELS], len[L24_MAX_CHANNELS];
+    int runs = 0;
+    for (int c = 0; c < dst_ch; c++)
+    {
+        int src = map ? map[c] : c;
+        if (src >= nch) src = -1;
+        if (runs && from[runs-1] >= 0 && src == from[runs-1] + len[runs-1]) { len[runs-1]++; continue; }
+        if (runs && from[runs-1] <  0 && src < 0)                           { len[runs-1]++; continue; }
+        at[runs] = c; from[runs] = src; len[runs] = 1; runs++;
+    }
+
+    if (runs == 1 && from[0] == 0 && nch == dst_ch)                 // All in order, one run for the lot
+    {
+        l24_unpack(dst, payload, frames * nch, shift);
+        return;
+    }
+
+    for (int f = 0; f < frames; f++, payload += 3 * nch, dst += dst_ch)
+    {
+        for (int r = 0; r < runs; r++)
+        {
+            if (from[r] < 0) for (int c = 0; c < len[r]; c++) dst[at[r] + c] = 0;
+            else             l24_unpack(dst + at[r], payload + 3 * from[r], len[r], shift);
+        }
+    }
+}
+
+// Frames of nch channels, stride words apart, packed into dst
+void __not_in_flash_func(l24_write)(uint8_t *dst, const int32_t *src, int stride, int nch, int frames, int shift)
+{
+    if (stride == nch)                                              // Nothing skipped, one run for the lot
+    {
+        l24_pack(dst, src, frames * nch, shift);
+        return;
+    }
+    for (int f = 0; f < frames; f++, src += stride, dst += 3 * nch) l24_pack(dst, src, nch, shift);
+}
@@ -0,0 +1,228 @@
+//////////////////////////////////////////////////////////////////////
+// Latency measurement, by sending a marker out and timing its return
+//
+// There used to be a commented out write of 0xFFFFFFFF into audio_out for
+// finding a block on a scope.  This does the job properly.  A marker is put
+// into one output channel, or into one slot of the network transmit, and
+// the ISR captures LAT_WINDOW frames of one input slot, or one slot of the
+// received flows, from the same block on.  With a cable or the codec looped
+// back, or a device on the network sending the stream back, the marker turns
+// up in the capture and its offset is the round trip in frames.
+//
+// The marker is either a single impulse, which is easy to see on a scope, or
+// a 255 sample MLS, which stands out from the noise of an analogue loop by
+// 48dB and isn't thrown by the EQ.  Both are at LAT_LEVEL and replace the
+// audio of that channel while they play, so only use this with nothing that
+// minds a short burst of noise on the channel.
+//
+// The ISR work is a compare per hook and a copy of one sample per frame
+// while capturing.  Finding the marker in the capture is done in the network
+// loop by latency_service(), a few lags each call so it never holds the loop
+// up.  The MLS is found by correlation, which is only adds and subtracts, and
+// the peak is refined to a fraction of a frame by fitting a parabola.  A peak
+// less than LAT_SNR times the average is counted as missed.
+//
+// Each result goes into a Histogram, and latency_text() gives the figures to
+// quote for a configuration along with how the round trip divides up.  The
+// parts known from the configuration are the DMA blocks on each side, the
+// group delay of filter2x and of the decimators, the RTP packet time and the
+// jitter buffer depth at the time.  The rest is outside this code, which is
+// the converters and cable for a loop through the codec, or the network and
+// the remote device for a network loop, plus the phase of the ISR within the
+// DMA blocks.
+//
+
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "histogram.hpp"
+
+#define LAT_WINDOW      2048                                        // Frames captured, 42ms at 48kHz
+#define LAT_MLS         255                                         // Length of the MLS, order 8
+#define LAT_LEVEL       0x0CCCCC                                    // -20dBFS of 24 bits
+#define LAT_PERIOD      24000                                       // Frames from one result to the next marker
+#define LAT_CHUNK       8                                           // Lags tried each latency_service()
+#define LAT_SNR         8
+#define LAT_TEXT_LINE   128                                         // Longest line of latency_text()
+
+enum LatencyMarker  { LAT_OFF, LAT_IMPULSE, LAT_MLS_MARKER };
+enum LatencyPoint   { LAT_OUTPUT, LAT_INPUT, LAT_NETWORK };
+enum LatencyPart    { LAT_IN_BLOCK, LAT_OUT_BLOCK, LAT_FIR_OUT, LAT_FIR_IN, LAT_PACKET, LAT_JITTER, LAT_PARTS };
+enum LatencyState   { LAT_IDLE, LAT_WAIT, LAT_RUN, LAT_DONE };
+
+struct Latency
+{
+    // Set by latency_start()
+    int                 marker;
+    int                 src, src_ch;                                // LAT_OUTPUT or LAT_NETWORK (transmit)
+    int                 det, det_ch;                                // LAT_INPUT or LAT_NETWORK (receive)
+    float               part[LAT_PARTS];                            // Known delays in frames
+    int8_t              mls[LAT_MLS];
+
+    // Handed between the ISR and the network loop
+    volatile int        state;
+    volatile uint32_t   frame;                                      // Frames since the start, at the current block
+    uint32_t            start;                                      // Frame to send the next marker
+    int                 inject, capture;
+    int16_t             cap[LAT_WINDOW];
+
+    // Search, in the network loop
+    int                 lag;
+    int32_t             best, best_lag;
+    int64_t             total;
+
+    // Results
+    float               last, min, max;
+    double              sum;
+    uint32_t            found, missed;
+};
+
+
+// Set up and start, part[] has the delays in frames known from the configuration
+inline void latency_start(Latency &lat, int marker, int src, int src_ch, int det, int det_ch, const float part[LAT_PARTS])
+{
+    lat.state = LAT_IDLE;
+    __dmb();
+    lat.marker = marker;
+    lat.src = src; lat.src_ch = src_ch;
+    lat.det = det; lat.det_ch = det_ch;
+    for (int p = 0; p < LAT_PARTS; p++) lat.part[p] = part[p];
+    uint32_t s = 1;
+    for (int i = 0; i < LAT_MLS; i++)                               // Galois LFSR, x^8 + x^6 + x^5 + x^4 + 1
+    {
+        lat.mls[i] = s & 1 ? 1 : -1;
+        s = (s >> 1) ^ (s & 1 ? 0xB8 : 0);
+    }
+    lat.found = lat.missed = 0;
+    lat.sum = 0;
+    lat.start = lat.frame + LAT_PERIOD;
+    __dmb();
+    if (marker != LAT_OFF) lat.state = LAT_WAIT;
+}
+
+// At the top of the ISR, starts the next marker when it is due
+static inline void __not_in_flash_func(latency_block)(Latency &lat)
+{
+    if (lat.state == LAT_WAIT && (int32_t)(lat.frame - lat.start) >= 0)
+    {
+        lat.inject  = 0;
+        lat.capture = 0;
+        lat.state   = LAT_RUN;
+    }
+}
+
+// Put the marker into n samples of channel ch at point, buf is 24 bit samples << shift
+static inline void __not_in_flash_func(latency_inject)(Latency &lat, int point, int ch, int32_t *buf, int stride, int n, int shift)
+{
+    if (lat.state != LAT_RUN || point != lat.src || ch != lat.src_ch) return;
+    int len = lat.marker == LAT_IMPULSE ? 1 : LAT_MLS;
+    for (int m = 0; m < n; m++, lat.inject++)
+    {
+        int32_t v = 0;
+        if (lat.inject < len) v = lat.marker == LAT_IMPULSE ? LAT_LEVEL : lat.mls[lat.inject] * LAT_LEVEL;
+        if (lat.inject < len + 1) buf[m * stride] = v << shift;    // One zero after, so an impulse is clean
+    }
+}
+
+// Capture n frames of an 8 slot full scale block at point
+static inline void __not_in_flash_func(latency_capture)(Latency &lat, int point, const int32_t *tdm, int n)
+{
+    if (lat.state != LAT_RUN || point != lat.det) return;
+    for (int m = 0; m < n && lat.capture < LAT_WINDOW; m++) lat.cap[lat.capture++] = tdm[8 * m + lat.det_ch] >> 16;
+    if (lat.capture == LAT_WINDOW)
+    {
+        lat.best = lat.lag = 0;
+        lat.total = 0;
+        __dmb();
+        lat.state = LAT_DONE;
+    }
+}
+
+// At the end of the ISR
+static inline void __not_in_flash_func(latency_end)(Latency &lat, int n)
+{
+    lat.frame = lat.frame + n;
+}
+
+
+// How well the marker matches the capture at one lag
+inline int32_t latency_score(const Latency &lat, int lag)
+{
+    if (lat.marker == LAT_IMPULSE) return abs(lat.cap[lag]);
+    int32_t z = 0;
+    for (int i = 0; i < LAT_MLS; i++) z += lat.mls[i] > 0 ? lat.cap[lag + i] : -lat.cap[lag + i];
+    return abs(z);
+}
+
+// Called from the network loop, works through the capture a few lags at a time
+// jitter is the jitter buffer depth in frames of the flow being received, if any
+inline void latency_service(Latency &lat, DAES67::Histogram *hist, int32_t jitter)
+{
+    if (lat.state != LAT_DONE) return;
+
+    int lags = LAT_WINDOW - (lat.marker == LAT_IMPULSE ? 1 : LAT_MLS);
+    for (int k = 0; k < LAT_CHUNK && lat.lag <= lags; k++, lat.lag++)
+    {
+        int32_t z = latency_score(lat, lat.lag);
+        lat.total += z;
+        if (z > lat.best) { lat.best = z; lat.best_lag = lat.lag; }
+    }
+    if (lat.lag <= lags) return;
+
+    int32_t mean = (int32_t)(lat.total / (lags + 1));
+    if (lat.best > 0 && lat.best >= LAT_SNR * mean)
+    {
+        float a = lat.best_lag > 0    ? latency_score(lat, lat.best_lag - 1) : 0;
+        float c = lat.best_lag < lags ? latency_score(lat, lat.best_lag + 1) : 0;
+        float b = lat.best, d = a - 2 * b + c;
+        float f = lat.best_lag + (d < 0 ? 0.5f * (a - c) / d : 0.0f);
+
+        lat.part[LAT_JITTER] = jitter;
+        lat.last = f;
+        if (lat.found == 0 || f < lat.min) lat.min = f;
+        if (lat.found == 0 || f > lat.max) lat.max = f;
+        lat.sum += f;
+        lat.found++;
+        if (hist) hist->add(f / 48000.0);
+    }
+    else lat.missed++;
+
+    lat.start = lat.frame + LAT_PERIOD;
+    __dmb();
+    lat.state = LAT_WAIT;
+}
+
+// The figures and their breakdown, for the status page or the console, stopping short of size bytes
+inline int latency_text(const Latency &lat, char *buf, int size)
+{
+    static const char *point[3] = { "output", "input", "network" };
+    static const char *name[LAT_PARTS] = { "input block", "output block", "filter2x", "decimation", "rtp packet", "jitter buffer" };
+    if (size < 2 * LAT_TEXT_LINE) return 0;                         // The first two lines, then the parts as they fit
+    if (lat.marker == LAT_OFF) return sprintf(buf, "LATENCY       off\n");
+
+    char *p = buf, *end = buf + size;
+    p += sprintf(p, "LATENCY       %s  %s %d -> %s %d   found %lu  missed %lu\n", lat.marker == LAT_IMPULSE ? "IMPULSE" : "MLS",
+                 point[lat.src], lat.src_ch, point[lat.det], lat.det_ch, (unsigned long)lat.found, (unsigned long)lat.missed);
+    if (lat.found == 0) return p - buf;
+
+    float mean = (float)(lat.sum / lat.found);
+    p += sprintf(p, "ROUND TRIP    last %7.1f  min %7.1f  max %7.1f  mean %7.1f frames   mean %8.1f us\n",
+                 lat.last, lat.min, lat.max, mean, mean * (1e6f / 48000));
+
+    bool used[LAT_PARTS] = { };
+    used[LAT_OUT_BLOCK] = used[LAT_FIR_OUT] = lat.src == LAT_OUTPUT;
+    used[LAT_PACKET]    = lat.src == LAT_NETWORK;
+    used[LAT_IN_BLOCK]  = used[LAT_FIR_IN] = lat.det == LAT_INPUT;
+    used[LAT_JITTER]    = lat.det == LAT_NETWORK;
+    float rest = mean;
+    for (int n = 0; n < LAT_PARTS; n++)
+    {
+        if (!used[n]) continue;
+        if (end - p < 2 * LAT_TEXT_LINE) break;                     // Keeps room for the rest
+        p += sprintf(p, "  %-14s %7.1f frames %8.1f us\n", name[n], lat.part[n], lat.part[n] * (1e6f / 48000));
+        rest -= lat.part[n];
+    }
+    p += sprintf(p, "  %-14s %7.1f frames %8.1f us\n", "the rest", rest, rest * (1e6f / 48000));
+    return p - buf;
+}
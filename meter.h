@@ -0,0 +1,124 @@
+//////////////////////////////////////////////////////////////////////
+// Per channel level metering and clip counts for the output channels
+//
+// The ISR calls meter_block() on each channel's new 24 bit samples as they
+// go into filter2x, along with the number of clips filter2x reported.  It
+// keeps the peak, a sum of squares and the counts, and meter_publish()
+// hands out a snapshot every 2^METER_WINDOW samples.
+//
+// There is no divide anywhere.  The squares are of the top 16 bits so each
+// fits in 32 bits, the sum is 64 bit (just an add with carry on the M0+),
+// and the mean is a shift as the window is a power of two.  About 10 cycles
+// per sample, so 300 cycles a block for 8 channels.
+//
+// Clips are counted in two places.  'in' is samples that reached the 24 bit
+// rails on the way in (codec, network, mixer or EQ), and 'out' is samples
+// that filter2x had to saturate from the overshoot of the upsampling and
+// pre-emphasis.  Both counts run forever, the peak and mean are per window.
+//
+// Snapshots go to the other core through a sequence lock.  The writer makes
+// the count odd while it copies, so the reader just retries if the count was
+// odd or changed, and the ISR never waits for anyone.
+//
+
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+
+#define METER_CHANNELS  8
+#define METER_WINDOW    13                                          // 8192 samples, 171ms at 48kHz
+#define METER_TEXT_LINE 64                                          // Longest line of meter_text()
+
+struct MeterSnapshot
+{
+    uint32_t    peak[METER_CHANNELS];                               // Largest |x| in 24 bit
+    uint32_t    ms[METER_CHANNELS];                                 // Mean of (x>>8)^2
+    uint32_t    clip_in[METER_CHANNELS];
+    uint32_t    clip_out[METER_CHANNELS];
+    uint32_t    windows;
+};
+
+struct Meter
+{
+    volatile uint32_t   seq;                                        // Odd while the snapshot is being written
+    MeterSnapshot       snap;
+    uint32_t            peak[METER_CHANNELS];                       // Accumulating, owned by the ISR
+    uint64_t            sum[METER_CHANNELS];
+    uint32_t            clip_in[METER_CHANNELS];
+    uint32_t            clip_out[METER_CHANNELS];
+    uint32_t            samples;
+};
+
+
+// Accumulate n samples of one channel, with the clips filter2x returned for it
+inline void __not_in_flash_func(meter_block)(Meter &m, int ch, const int32_t *in, int n, int clips)
+{
+    uint32_t peak = m.peak[ch];
+    uint64_t sum  = m.sum[ch];
+    int      cin  = 0;
+    for (int i = 0; i < n; i++)
+    {
+        int32_t  x = in[i];
+        uint32_t a = x < 0 ? -x : x;
+        if (a > peak) peak = a;
+        if (a >= 0x007FFFFF) cin++;
+        int32_t  h = x >> 8;
+        sum += (uint32_t)(h * h);
+    }
+    m.peak[ch]      = peak;
+    m.sum[ch]       = sum;
+    m.clip_in[ch]  += cin;
+    m.clip_out[ch] += clips;
+}
+
+// Called once per block after all of the channels, publishes at the end of each window
+inline void __not_in_flash_func(meter_publish)(Meter &m, int n)
+{
+    m.samples += n;
+    if (m.samples < (1u << METER_WINDOW)) return;
+    m.samples = 0;
+
+    m.seq++;
+    __dmb();
+    for (int c = 0; c < METER_CHANNELS; c++)
+    {
+        m.snap.peak[c]     = m.peak[c];
+        m.snap.ms[c]       = (uint32_t)(m.sum[c] >> METER_WINDOW);
+        m.snap.clip_in[c]  = m.clip_in[c];
+        m.snap.clip_out[c] = m.clip_out[c];
+        m.peak[c] = 0;
+        m.sum[c]  = 0;
+    }
+    m.snap.windows++;
+    __dmb();
+    m.seq++;
+}
+
+// Take a consistent copy of the last snapshot from the other core
+inline void meter_read(const Meter &m, MeterSnapshot &s)
+{
+    uint32_t seq;
+    do
+    {
+        while ((seq = m.seq) & 1) ;
+        __dmb();
+        s = m.snap;
+        __dmb();
+    } while (seq != m.seq);
+}
+
+// Text table of a snapshot in dBFS, one line per channel, stopping short of size bytes
+inline int meter_text(const MeterSnapshot &s, char *buf, int size)
+{
+    char *p = buf, *end = buf + size;
+    if (size < METER_TEXT_LINE) return 0;
+    p += sprintf(p, "CH   PEAK dBFS   RMS dBFS     CLIP IN    CLIP OUT\n");
+    for (int c = 0; c < METER_CHANNELS && end - p >= METER_TEXT_LINE; c++)
+    {
+        float peak = s.peak[c] ? 20.0f * log10f(s.peak[c] / 8388608.0f) : -144.0f;
+        float rms  = s.ms[c]   ? 10.0f * log10f(s.ms[c]   / 1073741824.0f) : -144.0f;
+        p += sprintf(p, "%2d  %10.1f %10.1f  %10lu  %10lu\n", c, peak, rms, (unsigned long)s.clip_in[c], (unsigned long)s.clip_out[c]);
+    }
+    return p - buf;
+}
@@ -0,0 +1,127 @@
+//////////////////////////////////////////////////////////////////////
+// Routing and mixing of the 8 TDM channels ahead of the upsampling
+//
+// Gains are int16 with 0x4000 as unity (Q14), so up to +6dB, stored as
+// gain[out][in].  The samples are taken down to 24 bits and each product
+// is done as two 16x16 multiplies, so nothing needs a 64 bit accumulator.
+// The outputs are saturated back to full scale int32 so the rest of the
+// chain is unchanged.
+//
+// Gains move towards their targets by at most MIX_RAMP per sample, and are
+// interpolated across each block, so mutes and changes are click free.
+// Pairs that are zero both now and in the target are skipped, which makes
+// sparse routing about as cheap as the number of connections.
+//
+// Parameters are double buffered.  The non-audio core fills the spare bank
+// with mixer_update(), and the ISR swaps banks at the start of the next block.
+//
+// The kernel is a template on the routing mode, so MIX_IDENTITY compiles to
+// nothing at all and the upsampling just reads straight from audio_tdm.
+// MIX_PAIRWISE only looks at the stereo pair for each output (balance, swap,
+// mono sum) for a quarter of the work of MIX_DENSE.
+//
+
+#pragma once
+#include <stdint.h>
+#include <math.h>
+
+#define MIX_CHANNELS    8
+#define MIX_UNITY       0x4000
+#define MIX_RAMP        64                                          // Unity to off in 256 samples (5.3ms)
+
+enum MixMode { MIX_IDENTITY, MIX_PAIRWISE, MIX_DENSE };
+
+struct MixParams
+{
+    int16_t     gain[MIX_CHANNELS][MIX_CHANNELS];                   // [out][in] in Q14
+    uint8_t     mute;                                               // One bit per output
+};
+
+struct Mixer
+{
+    MixParams           params[2];
+    volatile int        active;                                     // Bank the ISR is using
+    volatile bool       pending;                                    // Spare bank is ready to swap in
+    int16_t             gain[MIX_CHANNELS][MIX_CHANNELS];           // Current gains, owned by the ISR
+
+    Mixer() : params(), active(0), pending(false), gain()
+    {
+        for (int n = 0; n < MIX_CHANNELS; n++) params[0].gain[n][n] = params[1].gain[n][n] = gain[n][n] = MIX_UNITY;
+    }
+};
+
+
+// Convert a gain in dB for the non-audio core
+inline int16_t mixer_db(float db)
+{
+    if (db <= -90.0f) return 0;
+    float g = powf(10.0f, db / 20.0f) * MIX_UNITY;
+    return g > 32767.0f ? 32767 : (int16_t)(g + 0.5f);
+}
+
+// Post a new set of parameters from the non-audio core
+// Returns false if the last update has not been picked up yet, so try again later
+inline bool mixer_update(Mixer &m, const MixParams &p)
+{
+    if (m.pending) return false;
+    m.params[1 - m.active] = p;
+    __dmb();
+    m.pending = true;
+    return true;
+}
+
+// x is a 24 bit sample, g is Q14.  x*g >> 14 with two 16x16 multiplies.
+static inline int32_t __not_in_flash_func(mul24q14)(int32_t x, int32_t g)
+{
+    return (((x >> 8) * g) >> 6) + (((x & 0xFF) * g) >> 14);
+}
+
+// Mix n frames of MIX_CHANNELS from in to out, with a ramp from the current gain
+// Returns the buffer the next stage should read from
+template <int MODE, int N>
+const int32_t *__not_in_flash_func(mixer_process)(Mixer &m, const int32_t *in, int32_t *out)
+{
+    if constexpr (MODE == MIX_IDENTITY) return in;
+
+    if (m.pending) { m.active = 1 - m.active; m.pending = false; }
+    const MixParams &p = m.params[m.active];
+
+    int32_t acc[N][MIX_CHANNELS] = { };
+    for (int o = 0; o < MIX_CHANNELS; o++)
+    {
+        int first = MODE == MIX_PAIRWISE ? (o & ~1) : 0;
+        int last  = MODE == MIX_PAIRWISE ? first + 2 : MIX_CHANNELS;
+        for (int i = first; i < last; i++)
+        {
+            int32_t g0 = m.gain[o][i];
+            int32_t g1 = ((p.mute >> o) & 1) ? 0 : p.gain[o][i];
+            if (g0 == 0 && g1 == 0) continue;                       // Sparse, nothing to do
+
+            const int32_t *pin = in + i;
+            if (g0 == g1)
+            {
+                for (int n = 0; n < N; n++) acc[n][o] += mul24q14(pin[MIX_CHANNELS*n] >> 8, g0);
+            }
+            else
+            {
+                int32_t d = g1 - g0;
+                if (d >  MIX_RAMP*N) d =  MIX_RAMP*N;
+                if (d < -MIX_RAMP*N) d = -MIX_RAMP*N;
+                for (int n = 0; n < N; n++) acc[n][o] += mul24q14(pin[MIX_CHANNELS*n] >> 8, g0 + d*(n+1)/N);
+                m.gain[o][i] = g0 + d;
+            }
+        }
+    }
+
+    for (int n = 0; n < N; n++)
+    {
+        for (int o = 0; o < MIX_CHANNELS; o++)
+        {
+            int32_t z = acc[n][o];
+            if (z >  0x007FFFFF) z =  0x007FFFFF;
+            if (z < -0x00800000) z = -0x00800000;
+            out[MIX_CHANNELS*n + o] = z << 8;
+        }
+    }
+    return out;
+}
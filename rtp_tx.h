@@ -0,0 +1,198 @@
+//////////////////////////////////////////////////////////////////////
+// AES67 transmit of the 48kHz TDM capture as L24 RTP on the W5500
+//
+// The ISR packs each block of audio_tdm straight into a ring of packet
+// slots.  Each slot is laid out exactly as it goes out on the SPI bus,
+// being the three byte W5500 address/control phase, the 12 byte RTP
+// header and then the big endian 24 bit samples.  The network loop calls
+// rtp_tx_service(), which writes a whole slot into the socket TX buffer in
+// one burst and then issues SEND.
+//
+// TX credit is the number of free slots.  The ISR only ever writes into a
+// slot the network side has released, and if there are none it drops the
+// packet (keeping the timestamps running) and counts an overrun.  So the
+// ISR never waits on SPI, and a stalled network only costs whole packets.
+//
+// The next packet is written into the TX buffer while the previous one is
+// still being sent, and Sn_TX_WR is only moved on once SEND_OK arrives, as
+// SEND takes everything between Sn_TX_RD and Sn_TX_WR as one datagram.
+//
+// 8ch at 1ms is 1164 bytes, so 1167 bytes at 36MHz SPI or about 260us of
+// the 1ms, leaving plenty for the receive side in udp_test.
+//
+// flows_memory() gives socket 7 8k of TX memory, as with the default 2k
+// there is no room for the next 1164 byte packet until the last has gone.
+//
+// The RTP timestamp is the local 48kHz sample count.  There is no PTP here,
+// so receivers need to be slaved to this device or use a wide link offset.
+// It and the sequence number start from a random value as RFC3550 5.1 asks,
+// taken from the timer, which follows however long the discovery took.
+//
+
+#pragma once
+#include "histogram.hpp"
+#include "hal.h"
+#include "l24.h"
+
+extern "C" {
+#include "port_common.h"
+#include "wizchip_conf.h"
+#include "w5x00_spi.h"
+#include "socket.h"
+}
+
+#define RTP_TX_SOCK       7
+#define RTP_TX_GROUP      {239, 69, 0, 99}
+#define RTP_TX_PORT       5004
+#define RTP_TX_CHANNELS   8
+#define RTP_TX_FRAMES     48                                        // 48 for 1ms or 6 for 125us packet time
+#define RTP_TX_SLOTS      (RTP_TX_FRAMES >= 48 ? 4 : 16)             // About 4ms of slack either way
+#define RTP_TX_PT         96                                        // Dynamic payload type as used in the SDP
+#define RTP_TX_SSRC       0x50494330                                // 'PIC0'
+#define RTP_TX_HEADER     12
+#define RTP_TX_PAYLOAD    (RTP_TX_FRAMES*RTP_TX_CHANNELS*3)
+
+struct __attribute__((aligned(4))) RtpTxSlot
+{
+    uint8_t     pad;                                                // So the payload is word aligned for l24_write()
+    uint8_t     spi[3];                                             // W5500 address and control phase
+    uint8_t     rtp[RTP_TX_HEADER + RTP_TX_PAYLOAD];                // Header and payload, contiguous on the wire
+};
+
+struct RtpTx
+{
+    RtpTxSlot           slot[RTP_TX_SLOTS];
+    volatile uint32_t   head;                                       // Slots completed by the ISR
+    volatile uint32_t   tail;                                       // Slots written to the W5500
+    volatile bool       active;
+    int                 frame;                                      // Frames packed into the current slot
+    bool                dropping;                                   // No credit at the start of this packet
+    uint16_t            seq;
+    uint32_t            timestamp;                                  // Sample count at the start of this packet
+    uint16_t            wr;                                         // Our copy of Sn_TX_WR
+    uint16_t            staged;                                     // Bytes written beyond Sn_TX_WR
+    bool                busy;                                       // SEND issued, waiting for SEND_OK
+    volatile uint32_t   sent, overruns, timeouts;
+};
+
+RtpTx rtp_tx = { };
+
+
+// Open the transmit socket to a multicast group, and let the ISR start packing
+void rtp_tx_open(const uint8_t ip[4], int port)
+{
+    uint8_t ipc[4] = { ip[0], ip[1], ip[2], ip[3] };
+    uint8_t multicast_mac[6] = {0x01, 0x00, 0x5E, (uint8_t)(ip[1] & 0x7F), ip[2], ip[3]};
+    setSn_MR(RTP_TX_SOCK, Sn_MR_UDP);
+    setSn_DHAR(RTP_TX_SOCK, multicast_mac);
+    setSn_DIPR(RTP_TX_SOCK, ipc);
+    setSn_DPORT(RTP_TX_SOCK, port);
+    socket(RTP_TX_SOCK, Sn_MR_UDP, port, SF_IO_NONBLOCK | Sn_MR_MULTI);
+
+    rtp_tx.wr     = getSn_TX_WR(RTP_TX_SOCK);
+    rtp_tx.staged = 0;
+    rtp_tx.busy   = false;
+    rtp_tx.head   = rtp_tx.tail = 0;
+    rtp_tx.frame  = 0;
+    uint32_t r = hal_timer_us() * 2654435761u;                      // Knuth's multiplicative hash
+    rtp_tx.seq       = r >> 16;
+    rtp_tx.timestamp = (r ^ (r >> 15)) * 2246822519u;
+    __dmb();
+    rtp_tx.active = true;
+
+    printf("RTP TX TO     %d.%d.%d.%d:%d  %dch x %d\n", ip[0], ip[1], ip[2], ip[3], port, RTP_TX_CHANNELS, RTP_TX_FRAMES);
+}
+
+
+// Called from the ISR with n frames of channel data, stride apart
+void __not_in_flash_func(rtp_tx_push)(const int32_t *in, int n, int stride)
+{
+    if (!rtp_tx.active) return;
+
+    while (n > 0)
+    {
+        if (rtp_tx.frame == 0) rtp_tx.dropping = (rtp_tx.head - rtp_tx.tail) >= RTP_TX_SLOTS;
+
+        int take = RTP_TX_FRAMES - rtp_tx.frame;
+        if (take > n) take = n;
+
+        if (!rtp_tx.dropping)
+        {
+            uint8_t *p = rtp_tx.slot[rtp_tx.head % RTP_TX_SLOTS].rtp + RTP_TX_HEADER + rtp_tx.frame*RTP_TX_CHANNELS*3;
+            l24_write(p, in, stride, RTP_TX_CHANNELS, take, 0);
+        }
+        in += take*stride;
+
+        rtp_tx.frame += take;
+        n -= take;
+
+        if (rtp_tx.frame == RTP_TX_FRAMES)
+        {
+            if (!rtp_tx.dropping)
+            {
+                uint8_t *h = rtp_tx.slot[rtp_tx.head % RTP_TX_SLOTS].rtp;
+                h[0]  = 0x80;                                       // Version 2, no padding, extension or CSRC
+                h[1]  = RTP_TX_PT;
+                h[2]  = rtp_tx.seq >> 8;
+                h[3]  = rtp_tx.seq;
+                h[4]  = rtp_tx.timestamp >> 24;
+                h[5]  = rtp_tx.timestamp >> 16;
+                h[6]  = rtp_tx.timestamp >> 8;
+                h[7]  = rtp_tx.timestamp;
+                h[8]  = (uint8_t)(RTP_TX_SSRC >> 24);
+                h[9]  = (uint8_t)(RTP_TX_SSRC >> 16);
+                h[10] = (uint8_t)(RTP_TX_SSRC >> 8);
+                h[11] = (uint8_t)(RTP_TX_SSRC);
+                __dmb();
+                rtp_tx.head++;
+            }
+            else rtp_tx.overruns++;
+            rtp_tx.seq++;                                           // Receivers see a lost packet, not a gap in time
+            rtp_tx.timestamp += RTP_TX_FRAMES;
+            rtp_tx.frame = 0;
+        }
+    }
+}
+
+
+// Called from the network loop, never blocks
+void rtp_tx_service(void)
+{
+    if (!rtp_tx.active) return;
+
+    if (rtp_tx.busy)
+    {
+        uint8_t ir = getSn_IR(RTP_TX_SOCK);
+        if (ir & Sn_IR_TIMEOUT) { setSn_IR(RTP_TX_SOCK, Sn_IR_TIMEOUT); rtp_tx.timeouts++; rtp_tx.busy = false; }
+        if (ir & Sn_IR_SENDOK)  { setSn_IR(RTP_TX_SOCK, Sn_IR_SENDOK);  rtp_tx.sent++;     rtp_tx.busy = false; }
+    }
+
+    const int len = RTP_TX_HEADER + RTP_TX_PAYLOAD;
+    if (!rtp_tx.staged && rtp_tx.head != rtp_tx.tail && getSn_TX_FSR(RTP_TX_SOCK) >= len)
+    {
+        RtpTxSlot *s = &rtp_tx.slot[rtp_tx.tail % RTP_TX_SLOTS];
+        uint32_t addrsel = ((uint32_t)rtp_tx.wr << 8) + (WIZCHIP_TXBUF_BLOCK(RTP_TX_SOCK) << 3) + _W5500_SPI_WRITE_;
+        s->spi[0] = addrsel >> 16;
+        s->spi[1] = addrsel >> 8;
+        s->spi[2] = addrsel;
+
+        WIZCHIP_CRITICAL_ENTER();                                   // Core 1 serves HTTP on the same bus
+        WIZCHIP.CS._select();
+        spi_write_blocking(SPI_PORT, s->spi, 3 + len);              // Address, RTP header and payload in one go
+        WIZCHIP.CS._deselect();
+        WIZCHIP_CRITICAL_EXIT();
+
+        __dmb();
+        rtp_tx.tail++;                                              // Credit back to the ISR
+        rtp_tx.staged = len;
+    }
+
+    if (rtp_tx.staged && !rtp_tx.busy)
+    {
+        rtp_tx.wr += rtp_tx.staged;
+        rtp_tx.staged = 0;
+        setSn_TX_WR(RTP_TX_SOCK, rtp_tx.wr);
+        setSn_CR(RTP_TX_SOCK, Sn_CR_SEND);
+        rtp_tx.busy = true;
+    }
+}
@@ -0,0 +1,202 @@
+//////////////////////////////////////////////////////////////////////
+// Binary telemetry sent from the network loop on its own W5500 socket
+//
+// The HTML page and the printf of Histogram::text() every 20s are fine for
+// one board on the bench, but slow to format and no use for comparing many
+// boards.  This sends the numbers as they are, in the format of
+// telemetry_proto.h, to a multicast group that tools/telemetry_collect
+// listens on.
+//
+// Each datagram has the counters as absolute values, the half octave
+// histograms as deltas, and any new deadline events as trace records.  The
+// histograms are kept here rather than in Histogram, as the ISR adds to one
+// of them and it has to be cheap and in RAM.  tlm_add() is a few compares
+// and one increment, and only the writer of a histogram ever writes it.
+//
+// Sending is paced at TLM_HZ, and a byte budget of TLM_RATE per second stops
+// a bad spell of events from flooding the network.  telemetry_service() never
+// waits.  If the last SEND has not finished, there is no room in the socket
+// buffer or the budget is spent, that turn is skipped and counted.  Nothing
+// is lost by a skip, as the counters are absolute and the histogram deltas
+// and events just go in the next datagram.  The same goes for a histogram or
+// the events when too much has changed to fit, as the sent state only moves
+// on for what a finished datagram carries.  The sequence number only moves on
+// for a datagram that goes out, so a gap in the sequence numbers at the
+// collector is always loss on the network.
+//
+// The board id is the bottom of the flash unique id, read once at open.
+//
+
+#pragma once
+#include "telemetry_proto.h"
+#include "deadline.h"
+#include "meter.h"
+#include "flows.h"
+#include "rtp_tx.h"
+
+extern "C" {
+#include "pico/unique_id.h"
+#include "wizchip_conf.h"
+#include "socket.h"
+}
+
+#define TLM_SOCK        2
+#define TLM_GROUP       {239, 69, 0, 100}
+#define TLM_PORT        5005
+#define TLM_HZ          10                                          // Datagrams per second
+#define TLM_RATE        16000                                       // Bytes per second at most, averaged over a second
+
+struct Telemetry
+{
+    volatile uint32_t   hist[TLM_HISTS][TLM_BINS];                  // Live, each written by one side only
+    uint32_t            sent_hist[TLM_HISTS][TLM_BINS];             // As of the last datagram
+    bool                active;
+    bool                busy;                                       // SEND issued, waiting for SEND_OK
+    uint32_t            board;
+    uint32_t            seq;
+    uint64_t            next_us;
+    int32_t             credit;                                     // Bytes we may still send
+    uint32_t            events;                                     // Deadline events already sent
+    uint32_t            sent, skipped;
+    uint8_t             buf[TLM_MAX];
+};
+
+Telemetry tlm = { };
+
+extern Deadline             deadline;
+extern Meter                meter;
+extern volatile uint32_t    isr_worst[2];
+
+
+// Count one value into a histogram, from the ISR or the network loop
+static inline void __not_in_flash_func(tlm_add)(int h, uint32_t v)
+{
+    tlm.hist[h][tlm_bin(v)]++;
+}
+
+void telemetry_open(const uint8_t ip[4], int port)
+{
+    uint8_t ipc[4] = { ip[0], ip[1], ip[2], ip[3] };
+    uint8_t multicast_mac[6] = {0x01, 0x00, 0x5E, (uint8_t)(ip[1] & 0x7F), ip[2], ip[3]};
+    setSn_MR(TLM_SOCK, Sn_MR_UDP);
+    setSn_DHAR(TLM_SOCK, multicast_mac);
+    setSn_DIPR(TLM_SOCK, ipc);
+    setSn_DPORT(TLM_SOCK, port);
+    socket(TLM_SOCK, Sn_MR_UDP, port, SF_IO_NONBLOCK | Sn_MR_MULTI);
+
+    pico_unique_board_id_t id;
+    pico_get_unique_board_id(&id);
+    tlm.board   = (id.id[4] << 24) | (id.id[5] << 16) | (id.id[6] << 8) | id.id[7];
+    tlm.next_us = time_us_64();
+    tlm.credit  = TLM_RATE;
+    tlm.events  = deadline.events;
+    tlm.busy    = false;
+    tlm.active  = true;
+
+    printf("TELEMETRY TO  %d.%d.%d.%d:%d  board %08lx\n", ip[0], ip[1], ip[2], ip[3], port, (unsigned long)tlm.board);
+}
+
+
+// Fill tlm.buf with the next datagram and return its length.  A histogram or the events that do not
+// fit are left for the next one, and the sent state only moves on for what went in.
+static int telemetry_build(uint64_t now)
+{
+    TlmWriter w;
+    tlm_begin(w, tlm.buf, TLM_MAX, tlm.board, tlm.seq, now);
+
+    uint32_t miss = 0, near = 0;
+    for (int s = 0; s < DL_STAGES; s++) { miss += deadline.miss[s]; near += deadline.near_miss[s]; }
+    MeterSnapshot levels;
+    meter_read(meter, levels);
+    uint32_t clip_in = 0, clip_out = 0;
+    for (int c = 0; c < METER_CHANNELS; c++) { clip_in += levels.clip_in[c]; clip_out += levels.clip_out[c]; }
+
+    tlm_record(w, TLM_COUNTERS, 0);
+    tlm_counter(w, TLM_C_ISR_WORST,       isr_worst[0]);
+    tlm_counter(w, TLM_C_ISR_WORST_FLASH, isr_worst[1]);
+    tlm_counter(w, TLM_C_DL_BLOCKS,       deadline.blocks);
+    tlm_counter(w, TLM_C_DL_MISS,         miss);
+    tlm_counter(w, TLM_C_DL_NEAR,         near);
+    tlm_counter(w, TLM_C_DL_LATE,         deadline.late);
+    tlm_counter(w, TLM_C_DL_RXSTALL,      deadline.rxstall);
+    tlm_counter(w, TLM_C_DL_TXSTALL,      deadline.txstall);
+    tlm_counter(w, TLM_C_RTP_SENT,        rtp_tx.sent);
+    tlm_counter(w, TLM_C_RTP_OVERRUNS,    rtp_tx.overruns);
+    tlm_counter(w, TLM_C_RTP_TIMEOUTS,    rtp_tx.timeouts);
+    tlm_counter(w, TLM_C_CLIP_IN,         clip_in);
+    tlm_counter(w, TLM_C_CLIP_OUT,        clip_out);
+    tlm_counter(w, TLM_C_TLM_SKIPPED,     tlm.skipped);
+    for (int n = 0; n < FLOW_MAX; n++)
+    {
+        Flow &f = flows[n];
+        if (!f.active) continue;
+        uint32_t expected = f.seen ? f.highest - f.first + 1 : 0;
+        tlm_counter(w, TLM_FLOW(n, TLM_F_PACKETS),   f.packets);
+        tlm_counter(w, TLM_FLOW(n, TLM_F_LOST),      expected - f.packets);
+        tlm_counter(w, TLM_FLOW(n, TLM_F_LATE),      f.jb.late);
+        tlm_counter(w, TLM_FLOW(n, TLM_F_CONCEALED), f.jb.concealed);
+        tlm_counter(w, TLM_FLOW(n, TLM_F_OVERFLOWS), f.jb.overflows);
+        tlm_counter(w, TLM_FLOW(n, TLM_F_DEPTH),     f.jb.depth);
+        tlm_counter(w, TLM_FLOW(n, TLM_F_TARGET),    f.jb.target);
+        tlm_add(TLM_H_JB_DEPTH, f.jb.depth < 0 ? 0 : f.jb.depth);
+    }
+    tlm_record_end(w);
+
+    for (int h = 0; h < TLM_HISTS; h++) tlm_hist(w, h, tlm.hist[h], tlm.sent_hist[h]);
+
+    uint32_t events = deadline.events, from = tlm.events;
+    bool     traced = true;
+    if (events != from)
+    {
+        if (events - from > DL_EVENTS) from = events - DL_EVENTS;  // Older ones have been overwritten
+        tlm_record(w, TLM_TRACE, 0);
+        for (uint32_t i = from; i != events; i++)
+        {
+            const DlEvent &e = deadline.event[i % DL_EVENTS];
+            tlm_trace(w, e.time_us, e.kind, e.stage, e.value);
+        }
+        traced = tlm_record_end(w);
+    }
+
+    int len = tlm_finish(w);
+    if (len == 0) return 0;
+    for (int h = 0; h < TLM_HISTS; h++) tlm_hist_sent(tlm.buf, len, h, tlm.sent_hist[h]);     // Only what went in
+    if (traced) tlm.events = events;
+    return len;
+}
+
+// Called from the network loop, never blocks
+void telemetry_service(void)
+{
+    if (!tlm.active) return;
+
+    if (tlm.busy)
+    {
+        uint8_t ir = getSn_IR(TLM_SOCK);
+        if (ir & Sn_IR_TIMEOUT) { setSn_IR(TLM_SOCK, Sn_IR_TIMEOUT); tlm.busy = false; }
+        if (ir & Sn_IR_SENDOK)  { setSn_IR(TLM_SOCK, Sn_IR_SENDOK);  tlm.busy = false; }
+    }
+
+    uint64_t now = time_us_64();
+    if (now < tlm.next_us) return;
+    tlm.next_us += 1000000 / TLM_HZ;
+    if (tlm.next_us < now) tlm.next_us = now;                       // After a long stall, don't try to catch up
+    tlm.credit += TLM_RATE / TLM_HZ;
+    if (tlm.credit > TLM_RATE) tlm.credit = TLM_RATE;
+
+    if (tlm.busy || tlm.credit <= 0 || getSn_TX_FSR(TLM_SOCK) < TLM_MAX)
+    {
+        tlm.skipped++;
+        return;
+    }
+
+    int len = telemetry_build(now);
+    if (len == 0) { tlm.skipped++; return; }                        // Nothing has moved on, so it all goes next time
+    tlm.seq++;
+
+    wiz_send_data(TLM_SOCK, tlm.buf, len);
+    setSn_CR(TLM_SOCK, Sn_CR_SEND);
+    tlm.busy    = true;
+    tlm.credit -= len;                                              // Can go below zero, the next turns are then skipped
+    tlm.sent++;
+}
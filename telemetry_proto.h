@@ -0,0 +1,181 @@
+//////////////////////////////////////////////////////////////////////
+// Binary telemetry format, shared by the firmware and tools/telemetry_collect
+//
+// One UDP datagram is a header followed by records.  Everything is little
+// endian, which is what both ends are, but it is written a byte at a time so
+// there are no packing or alignment questions.
+//
+//   header   magic 'TLM1', version, flags, datagram length, board id,
+//            sequence number, board time in us                  (24 bytes)
+//   record   type, id, body length (u16), body
+//
+//   TLM_COUNTERS   body is n x { u16 counter, u32 value }, absolute values
+//                  so a lost datagram loses nothing but resolution
+//   TLM_HIST       id is the histogram, body is n x { u8 bin, u32 count }
+//                  of the bins that changed, as deltas since the last one
+//   TLM_TRACE      body is n x { u32 time us, u8 kind, u8 stage, u16 value }
+//
+// Histogram bins are half octaves.  Bin 0 is zero, then each power of two
+// is split in two, so bin 1 is 1, bins 2 and 3 are 2 and 3, bins 4 and 5 are
+// 4-5 and 6-7, and so on up to bin 63.  No bin is wider than half of its
+// lower edge, and it only needs shifts and compares, which suits the M0+.
+//
+// The collector uses the sequence number to count lost datagrams per board,
+// and so also the histogram deltas that went with them.
+//
+
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+#define TLM_MAGIC       0x314D4C54                                  // 'TLM1'
+#define TLM_VERSION     1
+#define TLM_HEADER      24
+#define TLM_MAX         1400                                        // Largest datagram, inside one Ethernet frame
+#define TLM_BINS        64
+
+enum TlmRecord  { TLM_COUNTERS = 1, TLM_HIST = 2, TLM_TRACE = 3 };
+
+enum TlmHistId  { TLM_H_ISR_US, TLM_H_READ_GAP_US, TLM_H_READ_BYTES, TLM_H_JB_DEPTH, TLM_HISTS };
+
+enum TlmCounter
+{
+    TLM_C_ISR_WORST, TLM_C_ISR_WORST_FLASH,
+    TLM_C_DL_BLOCKS, TLM_C_DL_MISS, TLM_C_DL_NEAR, TLM_C_DL_LATE, TLM_C_DL_RXSTALL, TLM_C_DL_TXSTALL,
+    TLM_C_RTP_SENT, TLM_C_RTP_OVERRUNS, TLM_C_RTP_TIMEOUTS,
+    TLM_C_CLIP_IN, TLM_C_CLIP_OUT,
+    TLM_C_TLM_SKIPPED,
+    TLM_COUNTERS_N
+};
+
+enum TlmFlowCounter { TLM_F_PACKETS, TLM_F_LOST, TLM_F_LATE, TLM_F_CONCEALED, TLM_F_OVERFLOWS, TLM_F_DEPTH, TLM_F_TARGET, TLM_FLOW_N };
+#define TLM_FLOW(n, c)  (0x100 * ((n) + 1) + (c))                   // Per flow counters, n from 0
+
+static const char *const tlm_hist_name[TLM_HISTS]        = { "isr_us", "read_gap_us", "read_bytes", "jb_depth" };
+static const char *const tlm_counter_name[TLM_COUNTERS_N] = { "isr_worst_us", "isr_worst_flash_us",
+                                                              "dl_blocks", "dl_miss", "dl_near", "dl_late", "dl_rxstall", "dl_txstall",
+                                                              "rtp_sent", "rtp_overruns", "rtp_timeouts",
+                                                              "clip_in", "clip_out", "tlm_skipped" };
+static const char *const tlm_flow_name[TLM_FLOW_N]       = { "packets", "lost", "late", "concealed", "overflows", "depth", "target" };
+static const char *const tlm_trace_name[4]               = { "miss", "late", "rxstall", "txstall" };
+
+
+// Half octave bin of a value, forced inline so the ISR can use it from RAM
+static inline __attribute__((always_inline)) int tlm_bin(uint32_t v)
+{
+    if (v <= 1) return v;
+    int e = 1;
+    while (e < 31 && (v >> (e + 1))) e++;
+    return 2 * e + ((v >> (e - 1)) & 1);
+}
+
+// Smallest value that lands in a bin
+static inline uint32_t tlm_bin_low(int b)
+{
+    if (b <= 1) return b < 0 ? 0 : b;
+    int e = b / 2;
+    return (1u << e) + ((b & 1) << (e - 1));
+}
+
+
+// Writing a datagram
+struct TlmWriter
+{
+    uint8_t    *buf;
+    int         len, cap;
+    int         record;                                             // Start of the open record, or -1
+    bool        full;
+};
+
+static inline void tlm_put8 (TlmWriter &w, uint32_t v) { if (w.len + 1 <= w.cap) w.buf[w.len++] = v; else w.full = true; }
+static inline void tlm_put16(TlmWriter &w, uint32_t v) { tlm_put8(w, v); tlm_put8(w, v >> 8); }
+static inline void tlm_put32(TlmWriter &w, uint32_t v) { tlm_put16(w, v); tlm_put16(w, v >> 16); }
+static inline void tlm_put64(TlmWriter &w, uint64_t v) { tlm_put32(w, (uint32_t)v); tlm_put32(w, (uint32_t)(v >> 32)); }
+
+static inline uint32_t tlm_get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static inline uint32_t tlm_get32(const uint8_t *p) { return tlm_get16(p) | (tlm_get16(p + 2) << 16); }
+static inline uint64_t tlm_get64(const uint8_t *p) { return tlm_get32(p) | ((uint64_t)tlm_get32(p + 4) << 32); }
+
+inline void tlm_begin(TlmWriter &w, uint8_t *buf, int cap, uint32_t board, uint32_t seq, uint64_t time_us)
+{
+    w.buf = buf; w.len = 0; w.cap = cap; w.record = -1; w.full = false;
+    tlm_put32(w, TLM_MAGIC);
+    tlm_put8 (w, TLM_VERSION);
+    tlm_put8 (w, 0);
+    tlm_put16(w, 0);                                                // Length, filled in by tlm_finish()
+    tlm_put32(w, board);
+    tlm_put32(w, seq);
+    tlm_put64(w, time_us);
+}
+
+inline void tlm_record(TlmWriter &w, int type, int id)
+{
+    w.record = w.len;
+    tlm_put8 (w, type);
+    tlm_put8 (w, id);
+    tlm_put16(w, 0);
+}
+
+// Close the open record.  One that ran out of room is taken out again, so what came before it
+// still goes, and false says it was left out.
+inline bool tlm_record_end(TlmWriter &w)
+{
+    if (w.record < 0) return !w.full;
+    if (w.full)
+    {
+        w.len    = w.record;
+        w.record = -1;
+        w.full   = false;
+        return false;
+    }
+    int body = w.len - w.record - 4;
+    w.buf[w.record + 2] = body;
+    w.buf[w.record + 3] = body >> 8;
+    w.record = -1;
+    return true;
+}
+
+inline void tlm_counter(TlmWriter &w, int id, uint32_t value)  { tlm_put16(w, id); tlm_put32(w, value); }
+
+inline void tlm_trace(TlmWriter &w, uint32_t time_us, int kind, int stage, int value)
+{
+    tlm_put32(w, time_us);
+    tlm_put8 (w, kind);
+    tlm_put8 (w, stage);
+    tlm_put16(w, value);
+}
+
+// Histogram deltas between now and last, only the bins that moved.  last is left alone, and
+// tlm_hist_sent() moves it on once the datagram is finished, so deltas that did not fit are kept.
+inline void tlm_hist(TlmWriter &w, int id, const volatile uint32_t *now, const uint32_t *last)
+{
+    tlm_record(w, TLM_HIST, id);
+    for (int b = 0; b < TLM_BINS; b++)
+    {
+        uint32_t n = now[b];
+        if (n == last[b]) continue;
+        tlm_put8 (w, b);
+        tlm_put32(w, n - last[b]);
+    }
+    tlm_record_end(w);
+}
+
+// Move last on by the deltas a finished datagram of len bytes carries for histogram id
+inline void tlm_hist_sent(const uint8_t *buf, int len, int id, uint32_t *last)
+{
+    for (int p = TLM_HEADER; p + 4 <= len; p += 4 + tlm_get16(buf + p + 2))
+    {
+        if (buf[p] != TLM_HIST || buf[p + 1] != id) continue;
+        int end = p + 4 + tlm_get16(buf + p + 2);
+        for (int q = p + 4; q + 5 <= end; q += 5) last[buf[q]] += tlm_get32(buf + q + 1);
+    }
+}
+
+// Returns the datagram length, or 0 if not even the header fitted
+inline int tlm_finish(TlmWriter &w)
+{
+    if (w.full) return 0;
+    w.buf[6] = w.len;
+    w.buf[7] = w.len >> 8;
+    return w.len;
+}
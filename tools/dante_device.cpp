@@ -0,0 +1,155 @@
+//////////////////////////////////////////////////////////////////////
+// A stand in Dante device on loopback, see dante_device.h
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "dante_device.h"
+
+#define DEVICE_FRAMES   48                                          // JB_FRAMES, 1ms at 48kHz
+#define DEVICE_LEVEL    0x3FFFFF                                    // -6dBFS of 24 bits
+
+static struct
+{
+    char        name[64];
+    uint8_t     ip[4], group[4];
+    int         port, channels;
+    int         mdns, reply, arc, rtp;                              // Sockets
+    uint32_t    seq, packets, queries;
+} dev;
+
+static int open_udp(const uint8_t ip[4], int port, bool join)
+{
+    sockaddr_in a = { };
+    a.sin_family = AF_INET;
+    a.sin_port   = htons(port);
+    memcpy(&a.sin_addr, ip, 4);
+    in_addr lo;
+    lo.s_addr = htonl(INADDR_LOOPBACK);
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &lo, sizeof(lo));
+    if (bind(fd, (sockaddr *)&a, sizeof(a)) < 0)
+    {
+        char s[32];
+        fprintf(stderr, "DEVICE cannot bind %s:%d\n", inet_ntop(AF_INET, &a.sin_addr, s, sizeof(s)), port);
+        close(fd);
+        return -1;
+    }
+    if (join)
+    {
+        ip_mreq m;
+        m.imr_multiaddr = a.sin_addr;
+        m.imr_interface = lo;
+        setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &m, sizeof(m));
+    }
+    return fd;
+}
+
+bool dante_device_open(const char *name, const uint8_t ip[4], const uint8_t group[4], int port, int channels)
+{
+    static const uint8_t mdns_group[4] = { 224, 0, 0, 251 };
+    snprintf(dev.name, sizeof(dev.name), "%s", name);
+    memcpy(dev.ip, ip, 4);
+    memcpy(dev.group, group, 4);
+    dev.port     = port;
+    dev.channels = channels;
+    dev.mdns  = open_udp(mdns_group, 5353, true);
+    dev.reply = open_udp(ip, 5353, false);                         // So the answer comes from the device's address
+    dev.arc   = open_udp(ip, 4440, false);
+    dev.rtp   = open_udp(ip, port, false);
+    return dev.mdns >= 0 && dev.reply >= 0 && dev.arc >= 0 && dev.rtp >= 0;
+}
+
+// A PTR answer for _netaudio-arc._udp.local, laid out as mdns_response() reads it
+static int mdns_answer(uint8_t *buf)
+{
+    static const uint8_t head[] = { 0x00, 0x00, 0x84, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00 };
+    static const uint8_t service[] = "\x0d_netaudio-arc\x04_udp\x05local";
+    int n = 0, len = strlen(dev.name);
+    memcpy(buf, head, sizeof(head));                                n += sizeof(head);
+    memcpy(buf + n, service, sizeof(service));                      n += sizeof(service);      // With the root label
+    static const uint8_t ptr[] = { 0x00, 0x0C, 0x00, 0x01, 0x00, 0x00, 0x11, 0x94 };          // PTR, IN, TTL 4500
+    memcpy(buf + n, ptr, sizeof(ptr));                              n += sizeof(ptr);
+    int rdlen = 1 + len + 2;
+    buf[n++] = rdlen >> 8;
+    buf[n++] = rdlen;
+    buf[n++] = len;                                                 // At 48
+    memcpy(buf + n, dev.name, len);                                 n += len;
+    buf[n++] = 0xC0;                                                // Pointer back to the service name
+    buf[n++] = 12;
+    return n;
+}
+
+static void answer_queries(void)
+{
+    uint8_t buf[1500];
+    sockaddr_in from;
+    socklen_t size = sizeof(from);
+    int len;
+    while ((len = recvfrom(dev.mdns, buf, sizeof(buf), 0, (sockaddr *)&from, &size)) > 0)
+    {
+        if (len < 26 || buf[2] || buf[3] || memcmp(buf + 12, "\x0d_netaudio-arc", 14)) continue;         // Queries only
+        sockaddr_in to = { };
+        to.sin_family = AF_INET;
+        to.sin_port   = htons(5353);
+        to.sin_addr.s_addr = inet_addr("224.0.0.251");
+        int n = mdns_answer(buf);
+        sendto(dev.reply, buf, n, 0, (sockaddr *)&to, sizeof(to));
+        dev.queries++;
+        size = sizeof(from);
+    }
+
+    size = sizeof(from);
+    while ((len = recvfrom(dev.arc, buf, sizeof(buf), 0, (sockaddr *)&from, &size)) > 0)
+    {
+        if (len < 8) continue;
+        // The query's header back, then the flow with the port just before the group
+        uint8_t reply[16] = { buf[0], buf[1], 0x00, 16, buf[4], buf[5], 0x00, 0x00, 0x00, 0x01,
+                              (uint8_t)(dev.port >> 8), (uint8_t)dev.port, dev.group[0], dev.group[1], dev.group[2], dev.group[3] };
+        sendto(dev.arc, reply, sizeof(reply), 0, (sockaddr *)&from, size);
+        dev.queries++;
+        size = sizeof(from);
+    }
+}
+
+void dante_device_service(void)
+{
+    if (dev.rtp < 0) return;
+    answer_queries();
+
+    uint8_t pkt[12 + 3 * 8 * DEVICE_FRAMES];
+    uint32_t ts = DEVICE_FRAMES * dev.seq;
+    uint8_t h[12] = { 0x80, 97, (uint8_t)(dev.seq >> 8), (uint8_t)dev.seq, (uint8_t)(ts >> 24), (uint8_t)(ts >> 16), (uint8_t)(ts >> 8), (uint8_t)ts,
+                      dev.ip[0], dev.ip[1], dev.ip[2], dev.ip[3] };
+    memcpy(pkt, h, 12);
+    uint8_t *p = pkt + 12;
+    for (int f = 0; f < DEVICE_FRAMES; f++)
+        for (int c = 0; c < dev.channels; c++)
+        {
+            double hz = 250.0 * (c + 1);
+            int32_t v = (int32_t)lrint(DEVICE_LEVEL * sin(2 * M_PI * hz * (double)(ts + f) / 48000));
+            *p++ = v >> 16; *p++ = v >> 8; *p++ = v;
+        }
+    sockaddr_in to = { };
+    to.sin_family = AF_INET;
+    to.sin_port   = htons(dev.port);
+    memcpy(&to.sin_addr, dev.group, 4);
+    sendto(dev.rtp, pkt, p - pkt, 0, (sockaddr *)&to, sizeof(to));
+    dev.seq++;
+    dev.packets++;
+}
+
+void dante_device_counts(uint32_t &packets, uint32_t &queries)
+{
+    packets = dev.packets;
+    queries = dev.queries;
+}
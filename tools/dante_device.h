@@ -0,0 +1,27 @@
+//////////////////////////////////////////////////////////////////////
+// A stand in Dante device on loopback, for tools/pipeline_host
+//
+// Just enough of one for dante_test() to find it and open its flow.  It
+// answers the mDNS query for _netaudio-arc._udp.local with its name, answers
+// the query on port 4440 with its multicast group and port in the place
+// dante_snoop.h looks for them, and sends an L24 flow of a sine on each
+// channel, one packet of JB_FRAMES each millisecond.
+//
+// It uses POSIX sockets bound to its own address in 127/8 and is run from
+// the simulated clock with hal_linux_every(), so it keeps pace with the
+// pipeline whether or not that is running in real time.
+//
+
+#pragma once
+#include <stdint.h>
+
+#define DANTE_DEVICE_PACKET_US  1000
+
+// ip is in 127/8, group and port are where the flow goes
+bool dante_device_open(const char *name, const uint8_t ip[4], const uint8_t group[4], int port, int channels);
+
+// Every DANTE_DEVICE_PACKET_US, answers any queries and sends the next packet
+void dante_device_service(void);
+
+// Packets sent and queries answered
+void dante_device_counts(uint32_t &packets, uint32_t &queries);
@@ -0,0 +1,112 @@
+//////////////////////////////////////////////////////////////////////
+// Frequency response and speed of the half band decimators in decimate.h
+//
+//   decimate_bench [iterations]
+//
+// Sines are run through the fixed point code as the ISR feeds it, scaled
+// down by DECIMATE_SHIFT, and the level of the output at the frequency it
+// lands on is fitted by least squares.  The passband is checked to 20kHz and
+// the stopband over everything that aliases into 0-20kHz at the output,
+// against the figures in the header of decimate.h.  Then each filter is timed
+// on a block.  The times are for this host, not the M0+.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "pico/stdlib.h"
+#include "decimate.h"
+
+#define LEVEL   0.5                                                 // -6dBFS, the sines are 18 bits after the shift
+#define SKIP    64                                                  // Outputs before the filters have settled
+#define FIT     4800                                                // Outputs fitted
+
+typedef void (*Decimator)(int32_t *, int32_t *, int, int);
+
+// Level in dB of the output of one sine at hz into fs_in, measured at the frequency it lands on
+static double response(Decimator f, int taps, double fs_in, double hz, bool shifted_out)
+{
+    int n_out = SKIP + FIT;
+    std::vector<int32_t> in(taps - 1 + 2 * n_out), out(n_out);
+    for (size_t i = 0; i < in.size(); i++)
+        in[i] = (int32_t)lrint(LEVEL * 2147483647.0 * sin(2 * M_PI * hz * i / fs_in)) >> DECIMATE_SHIFT;
+    f(&in[taps - 1], &out[0], n_out, 1);
+
+    double fs_out = fs_in / 2, at = fmod(hz, fs_out);
+    if (at > fs_out / 2) at = fs_out - at;                          // Where it aliases to
+    double scale = shifted_out ? 1.0 / (1 << (31 - DECIMATE_SHIFT)) : 1.0 / 2147483648.0;
+    double cc = 0, ss = 0, cs = 0, yc = 0, ys = 0;
+    for (int i = SKIP; i < n_out; i++)
+    {
+        double c = cos(2 * M_PI * at * i / fs_out), s = sin(2 * M_PI * at * i / fs_out), y = out[i] * scale;
+        cc += c * c; ss += s * s; cs += c * s; yc += y * c; ys += y * s;
+    }
+    double det = cc * ss - cs * cs;
+    if (fabs(det) < 1e-9) return 20 * log10(fabs(yc / cc) / LEVEL + 1e-12);    // DC
+    double a = (yc * ss - ys * cs) / det, b = (ys * cc - yc * cs) / det;
+    return 20 * log10(sqrt(a * a + b * b) / LEVEL + 1e-12);
+}
+
+struct Spec
+{
+    const char *name;
+    Decimator   f;
+    int         taps;
+    double      fs_in, pass_hz, ripple_db, stop_hz, stop_db;
+    bool        shifted_out;                                        // decimate2x_pre leaves the output scaled down
+};
+
+static int check(const Spec &s)
+{
+    double lo = 1e9, hi = -1e9, worst = -1e9, worst_hz = 0;
+    for (double hz = 20; hz <= s.pass_hz; hz += 97)
+    {
+        double db = response(s.f, s.taps, s.fs_in, hz, s.shifted_out);
+        if (db < lo) lo = db;
+        if (db > hi) hi = db;
+    }
+    for (double hz = s.stop_hz; hz < s.fs_in / 2; hz += 97)
+    {
+        double db = response(s.f, s.taps, s.fs_in, hz, s.shifted_out);
+        if (db > worst) { worst = db; worst_hz = hz; }
+    }
+    bool pass = hi <= s.ripple_db && lo >= -s.ripple_db && worst <= -s.stop_db;
+    printf("%-15s pass 0-%.0fHz %+.4f %+.4f dB (spec +-%.3f)   stop >%.0fHz %.1f dB at %.0fHz (spec %.0f)   %s\n",
+           s.name, s.pass_hz, lo, hi, s.ripple_db, s.stop_hz, -worst, worst_hz, s.stop_db, pass ? "PASS" : "FAIL");
+    return !pass;
+}
+
+static double now_ns(void)
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static void bench(const char *name, Decimator f, int taps, int iters)
+{
+    const int n = 4;                                                // ISR_BLOCK outputs per channel
+    static int32_t in[64 + 2 * n], out[n];
+    for (int i = 0; i < (int)(sizeof(in) / sizeof(in[0])); i++) in[i] = rand() >> DECIMATE_SHIFT;
+    double t0 = now_ns();
+    for (int i = 0; i < iters; i++) { f(in + taps - 1, out, n, 1); __asm__ volatile("" ::: "memory"); }
+    printf("  %-15s %6.2f ns/output on this host\n", name, (now_ns() - t0) / iters / n);
+}
+
+int main(int argc, char **argv)
+{
+    int iters = argc > 1 ? atoi(argv[1]) : 2000000;
+    const Spec specs[] =
+    {
+        { "decimate2x",     decimate2x,     DECIMATE2X_TAPS,     96000,  20000, 0.005, 28000, 66, false },
+        { "decimate2x_pre", decimate2x_pre, DECIMATE2X_PRE_TAPS, 192000, 20000, 0.002, 76000, 73, true  },
+    };
+    int fails = 0;
+    for (const Spec &s : specs) fails += check(s);
+    bench("decimate2x",     decimate2x,     DECIMATE2X_TAPS,     iters);
+    bench("decimate2x_pre", decimate2x_pre, DECIMATE2X_PRE_TAPS, iters);
+    return fails ? 1 : 0;
+}
@@ -0,0 +1,425 @@
+//////////////////////////////////////////////////////////////////////
+// The Linux backend of hal.h, see tools/host/hal_linux.h
+//
+// Everything runs off the event hooks of the mock W5500, so the network
+// loop, the ISR and the loopback bridge share one simulated clock.  With
+// realtime each event waits for the wall clock to reach its time, which is
+// how the process keeps to 48kHz, otherwise it runs as fast as it can.
+//
+// The bridge gives each UDP socket open on the mock a POSIX socket.  One in
+// multicast mode is bound to its group and port and joins the group on
+// loopback, any other is bound to the board's address moved into 127/8,
+// so 10.0.0.99 is 127.0.0.99.  Unicast destinations are moved the same way
+// and multicast ones are left alone, as Linux will loop multicast on lo with
+// IP_MULTICAST_IF set to 127.0.0.1.  What the sockets receive is delivered to
+// the mock every BRIDGE_POLL_US, with a 127 source moved back into the
+// board's network.  Datagrams the board sent itself are dropped, as the W5500
+// does not hear its own multicast.
+//
+// No <socket.h> of the ioLibrary in here, the POSIX socket() and close() are
+// the ones wanted.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "hal_linux.h"
+#include "mock_w5500.h"
+#include "wizchip_conf.h"
+#include "wav.h"
+
+#define BRIDGE_POLL_US  100
+#define HAL_EVERY       8
+#define HAL_LINES       4                                           // i2s_double_out lines, two channels each at 96kHz
+#define HAL_FRAMES      16                                          // Most frames per block
+#define HAL_DMA_IN      0                                           // The input data channel, as pipeline_host gives deadline_init()
+
+pio_hw_t hal_pio[2];
+
+struct Every
+{
+    double      period, next;
+    void      (*fn)(void);
+};
+
+struct Bridge
+{
+    int         fd = -1;
+    bool        open;                                               // Set up for an open mock socket, fd is -1 if bind failed
+    bool        multi;
+    uint8_t     ip[4];                                              // Bound to, the group or the board in 127/8
+    int         port;
+};
+
+static struct
+{
+    bool        realtime;
+    double      wall0, stop_us;
+    void      (*done)(void);
+
+    void      (*isr)(void);
+    int32_t    *in, *out;
+    int         frames;
+    double      period_us, next_isr, block_wall;
+    int         half;
+    uint32_t    pending;                                            // DMA interrupt 0 raised and not yet acked
+    WavFile     wav_in, wav_out;
+
+    Every       every[HAL_EVERY];
+    int         nevery;
+    Bridge      sock[MOCK_SOCKETS];
+    uint32_t    gpio;
+    HalLinuxStats stats;
+} hal;
+
+
+static double wall_us(void)
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec * 1e-3 - hal.wall0;
+}
+
+
+// The Pico calls
+uint32_t hal_timer_us(void)
+{
+    return (uint32_t)wall_us();
+}
+
+// The input's control channel raises the interrupt, as dma_setup() sets it up
+static uint32_t hal_dma_irq(void)
+{
+    return 1u << hal_dma_chain(HAL_DMA_IN);
+}
+
+void hal_dma_ack(uint32_t mask)
+{
+    hal.pending &= ~mask;
+}
+
+// Raised at the start of each block until acked, and raised again once a whole block has gone since
+uint32_t hal_dma_pending(uint32_t mask)
+{
+    uint32_t raised = hal.pending;
+    if (hal.out && wall_us() - hal.block_wall >= hal.period_us) raised |= hal_dma_irq();
+    return raised & mask;
+}
+
+// Output line 0, moved on through the block at the rate it would be played
+uintptr_t hal_dma_read_addr(int)
+{
+    if (!hal.out) return 0;
+    uint32_t words    = hal.frames * 4;
+    uint32_t progress = (uint32_t)((wall_us() - hal.block_wall) / hal.period_us * words);
+    return (uintptr_t)(hal.out + (hal.half * words + progress) % (2 * words));
+}
+
+int hal_dma_chain(int ch)
+{
+    return ch + 1;                                                  // As dma_setup() claims them, data then control
+}
+
+uint32_t hal_pio_stalls(pio_hw_t *pio, uint32_t bits)
+{
+    uint32_t v = pio->fdebug & bits;
+    pio->fdebug &= ~v;
+    return v;
+}
+
+void hal_gpio_out(int)
+{
+}
+
+void hal_gpio_put(int pin, bool v)
+{
+    hal.gpio = v ? hal.gpio | (1u << pin) : hal.gpio & ~(1u << pin);
+}
+
+bool hal_gpio_get(int pin)
+{
+    return (hal.gpio >> pin) & 1;
+}
+
+
+// A frame of 8 slots in the order i2s_four_in shifts them in.  Pin p carries slots 2p and 2p+1, a
+// byte of each of the four pins to a word, most significant first, the left slot in the first four
+static void pio_four_in(const int32_t *tdm, int32_t *word)
+{
+    for (int w = 0; w < 8; w++)
+    {
+        int side = w >> 2, shift = 8 * (3 - (w & 3));
+        uint32_t v = 0;
+        for (int k = 0; k < 8; k++)
+            for (int p = 0; p < 4; p++)
+                v |= (((uint32_t)tdm[2 * p + side] >> (shift + k)) & 1) << (4 * k + p);
+        word[w] = v;
+    }
+}
+
+static void audio_block(void)
+{
+    static std::vector<int32_t> in;                                 // The file may have any number of channels
+    int frames = hal.frames;
+    int32_t tdm[HAL_FRAMES][8] = { };
+    if (hal.wav_in.f)
+    {
+        in.resize(frames * hal.wav_in.channels);
+        int n = wav_read(hal.wav_in, in.data(), frames);
+        for (int m = 0; m < n; m++)
+            for (int c = 0; c < 8 && c < hal.wav_in.channels; c++) tdm[m][c] = in[m * hal.wav_in.channels + c];
+    }
+    for (int m = 0; m < frames; m++) pio_four_in(tdm[m], hal.in + (hal.half * frames + m) * 8);
+
+    double now = wall_us();
+    hal.block_wall = hal.realtime ? hal.next_isr : now;
+    if (hal.realtime && now - hal.next_isr >= hal.period_us)
+    {
+        hal.stats.late_blocks++;
+        hal_pio[0].fdebug |= 1u << PIO_FDEBUG_RXSTALL_LSB;          // The input FIFO would have filled
+    }
+    hal.pending |= hal_dma_irq();
+    hal.isr();
+    if (hal.pending & hal_dma_irq())                                // On the board it would be entered again at once
+    {
+        hal.stats.unacked++;
+        hal.pending &= ~hal_dma_irq();
+    }
+    double took = wall_us() - now;
+    hal.stats.blocks++;
+    hal.stats.isr_us += took;
+    if (took > hal.stats.isr_max_us) hal.stats.isr_max_us = took;
+
+    if (hal.wav_out.f)
+    {
+        int32_t out[2 * HAL_FRAMES][2 * HAL_LINES];
+        for (int l = 0; l < HAL_LINES; l++)
+            for (int m = 0; m < frames; m++)
+            {
+                const int32_t *w = hal.out + ((l * 2 + hal.half) * frames + m) * 4;
+                out[2 * m][2 * l]     = w[0];
+                out[2 * m][2 * l + 1] = w[1];
+                out[2 * m + 1][2 * l]     = w[2];
+                out[2 * m + 1][2 * l + 1] = w[3];
+            }
+        wav_write(hal.wav_out, out[0], 2 * frames);
+    }
+    hal.half ^= 1;
+}
+
+
+// The loopback bridge
+static bool multicast(const uint8_t ip[4])
+{
+    return ip[0] >= 224 && ip[0] < 240;
+}
+
+static void loopback(const uint8_t ip[4], sockaddr_in &a, int port)
+{
+    memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET;
+    a.sin_port   = htons(port);
+    uint8_t *p = (uint8_t *)&a.sin_addr;
+    memcpy(p, ip, 4);
+    if (!multicast(ip)) p[0] = 127;
+}
+
+// Open, close or rebind the POSIX socket to match mock socket s
+static Bridge &bridge_sync(int s)
+{
+    const MockSocket &k = mock.sock[s];
+    Bridge &b = hal.sock[s];
+    bool open  = k.reg[0x03] == SOCK_UDP;
+    bool multi = (k.reg[0x00] & Sn_MR_MULTI) != 0;
+    int  port  = (k.reg[0x04] << 8) | k.reg[0x05];
+    const uint8_t *ip = multi ? &k.reg[0x0C] : &mock.creg[0x0F];
+    if (b.open == open && (!open || (b.multi == multi && b.port == port && !memcmp(b.ip, ip, 4)))) return b;
+    if (b.fd >= 0) close(b.fd);
+    b.fd   = -1;
+    b.open = open;
+    if (!open) return b;
+
+    b.multi = multi;
+    b.port  = port;
+    memcpy(b.ip, ip, 4);
+    sockaddr_in a;
+    loopback(ip, a, port);
+    int one = 1;
+    in_addr lo;
+    lo.s_addr = htonl(INADDR_LOOPBACK);
+    b.fd = socket(AF_INET, SOCK_DGRAM, 0);
+    fcntl(b.fd, F_SETFL, O_NONBLOCK);
+    setsockopt(b.fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(b.fd, IPPROTO_IP, IP_MULTICAST_IF, &lo, sizeof(lo));
+    if (bind(b.fd, (sockaddr *)&a, sizeof(a)) < 0)
+    {
+        char name[32];
+        fprintf(stderr, "BRIDGE socket %d cannot bind %s:%d, %s\n", s, inet_ntop(AF_INET, &a.sin_addr, name, sizeof(name)), port, strerror(errno));
+        close(b.fd);
+        b.fd = -1;
+        return b;
+    }
+    if (multi)
+    {
+        ip_mreq m;
+        m.imr_multiaddr = a.sin_addr;
+        m.imr_interface = lo;
+        setsockopt(b.fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &m, sizeof(m));
+    }
+    return b;
+}
+
+// The address the board's datagrams come from, to drop them coming back
+static bool from_board(const sockaddr_in &from)
+{
+    for (int s = 0; s < MOCK_SOCKETS; s++)
+    {
+        const Bridge &b = hal.sock[s];
+        if (b.fd < 0 || ntohs(from.sin_port) != b.port) continue;
+        sockaddr_in self;
+        loopback(b.ip, self, b.port);
+        if (b.multi) self.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (from.sin_addr.s_addr == self.sin_addr.s_addr) return true;
+    }
+    return false;
+}
+
+static void bridge_wire(int s, const uint8_t ip[4], int port, const uint8_t *data, int len)
+{
+    Bridge &b = bridge_sync(s);
+    if (b.fd < 0) return;
+    sockaddr_in a;
+    loopback(ip, a, port);
+    if (sendto(b.fd, data, len, 0, (sockaddr *)&a, sizeof(a)) == len) hal.stats.udp_out++;
+}
+
+static void bridge_poll(void)
+{
+    static uint8_t buf[2048];
+    for (int s = 0; s < MOCK_SOCKETS; s++)
+    {
+        Bridge &b = bridge_sync(s);
+        if (b.fd < 0) continue;
+        for (int n = 0; n < 64; n++)
+        {
+            sockaddr_in from;
+            socklen_t size = sizeof(from);
+            int len = recvfrom(b.fd, buf, sizeof(buf), MSG_DONTWAIT, (sockaddr *)&from, &size);
+            if (len < 0) break;
+            if (from_board(from)) continue;
+            uint8_t src[4];
+            memcpy(src, &from.sin_addr, 4);
+            if (src[0] == 127) src[0] = mock.creg[0x0F];
+            mock_deliver(b.ip, b.port, src, ntohs(from.sin_port), buf, len);
+            hal.stats.udp_in++;
+        }
+    }
+}
+
+
+// The events of the simulated clock
+static double next_event(void)
+{
+    double t = hal.stop_us;
+    if (hal.isr && hal.next_isr < t) t = hal.next_isr;
+    for (int e = 0; e < hal.nevery; e++) if (hal.every[e].next < t) t = hal.every[e].next;
+    return t;
+}
+
+static double run_event(void)
+{
+    double t = next_event();
+    if (hal.realtime)
+    {
+        double wait = t - wall_us();
+        if (wait > 0)
+        {
+            timespec d = { (time_t)(wait * 1e-6), (long)(fmod(wait, 1e6) * 1e3) };
+            nanosleep(&d, nullptr);
+        }
+    }
+    if (t >= hal.stop_us)
+    {
+        wav_close(hal.wav_out);
+        wav_close(hal.wav_in);
+        hal.stats.wall_us = wall_us();
+        if (hal.done) hal.done();
+        exit(0);
+    }
+    if (hal.isr && hal.next_isr <= t)
+    {
+        audio_block();
+        hal.next_isr += hal.period_us;
+        return 0;
+    }
+    for (int e = 0; e < hal.nevery; e++)
+    {
+        Every &v = hal.every[e];
+        if (v.next > t) continue;
+        v.next += v.period;
+        v.fn();
+        break;
+    }
+    return 0;
+}
+
+
+void hal_linux_start(bool realtime, double seconds, void (*done)(void))
+{
+    hal.wall0    = 0;
+    hal.wall0    = wall_us();
+    hal.realtime = realtime;
+    hal.stop_us  = seconds > 0 ? seconds * 1e6 : 1e300;
+    hal.done     = done;
+    mock.wire       = bridge_wire;
+    mock.next_event = next_event;
+    mock.run_event  = run_event;
+    mock_reset(36e6, 0.5);                                          // As pcap_replay, the SPI of udp_test.h
+    hal_linux_every(BRIDGE_POLL_US, bridge_poll);
+}
+
+void hal_linux_audio(void (*isr)(void), int32_t *in, int32_t *out, int frames)
+{
+    if (frames > HAL_FRAMES) { fprintf(stderr, "hal_linux_audio() takes up to %d frames\n", HAL_FRAMES); exit(1); }
+    hal.in        = in;
+    hal.out       = out;
+    hal.frames    = frames;
+    hal.period_us = frames * 1e6 / 48000;
+    hal.next_isr  = mock.now + hal.period_us;
+    hal.half      = 0;
+    hal.isr       = isr;
+}
+
+bool hal_linux_wav_in(const char *file)
+{
+    if (!wav_open_read(file, hal.wav_in)) return false;
+    if (hal.wav_in.rate != 48000) fprintf(stderr, "%s is %d Hz, played at 48000\n", file, hal.wav_in.rate);
+    return true;
+}
+
+bool hal_linux_wav_out(const char *file)
+{
+    return wav_open_write(file, hal.wav_out, 2 * HAL_LINES, 96000, 32);
+}
+
+void hal_linux_every(double period_us, void (*fn)(void))
+{
+    if (hal.nevery == HAL_EVERY) { fprintf(stderr, "hal_linux_every() is full\n"); return; }
+    hal.every[hal.nevery++] = { period_us, mock.now + period_us, fn };
+}
+
+HalLinuxStats hal_linux_stats(void)
+{
+    HalLinuxStats s = hal.stats;
+    if (!s.wall_us) s.wall_us = wall_us();
+    return s;
+}
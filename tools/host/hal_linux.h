@@ -0,0 +1,72 @@
+//////////////////////////////////////////////////////////////////////
+// The Linux backend of hal.h, for running the pipeline as a process
+//
+// The calls are the same as the Pico ones, implemented in tools/hal_linux.cpp
+// over a fake DMA clock.  Every ISR_BLOCK frames of 48kHz, in the simulated
+// time of the mock W5500, one half of audio_int is filled from a WAV file in
+// the bit order the i2s_four_in program leaves it, the handler is called, and
+// the same half of the four audio_out lines is written to a WAV file at 96kHz.
+//
+// The timer is the host's monotonic clock, so the ISR times are what the
+// host takes.  The output DMA position moves on with it from the start of
+// the block, which with --realtime is when the block was due and otherwise
+// when the handler was called, so the deadline monitor reads the host's
+// headroom.  A block that starts a whole block late in real time sets
+// RXSTALL on pio0, as the input FIFO would have overflowed.
+//
+// The UDP the firmware sends through the mock goes out of POSIX sockets on
+// loopback, and what those receive is delivered to the mock, see
+// hal_linux_start().
+//
+
+#pragma once
+#include <stdint.h>
+#include "pico/stdlib.h"
+
+#define PIO_FDEBUG_TXSTALL_LSB  24
+#define PIO_FDEBUG_RXSTALL_LSB  0
+
+typedef struct
+{
+    volatile uint32_t fdebug;
+} pio_hw_t;
+
+extern pio_hw_t hal_pio[2];
+#define pio0    (&hal_pio[0])
+#define pio1    (&hal_pio[1])
+
+uint32_t    hal_timer_us(void);
+void        hal_dma_ack(uint32_t mask);
+uint32_t    hal_dma_pending(uint32_t mask);
+uintptr_t   hal_dma_read_addr(int ch);
+int         hal_dma_chain(int ch);
+uint32_t    hal_pio_stalls(pio_hw_t *pio, uint32_t bits);
+void        hal_gpio_out(int pin);
+void        hal_gpio_put(int pin, bool v);
+bool        hal_gpio_get(int pin);
+
+
+// Set up the mock W5500 and the loopback bridge, and stop after seconds of simulated time
+// calling done() first, or never with 0.  realtime keeps the simulated clock with the wall clock.
+void        hal_linux_start(bool realtime, double seconds, void (*done)(void));
+
+// Start the fake DMA clock, in is audio_int and out is audio_out, frames is ISR_BLOCK
+void        hal_linux_audio(void (*isr)(void), int32_t *in, int32_t *out, int frames);
+
+// WAV files for the input, 48kHz up to 8 channels, and for the 8 channel 96kHz output
+bool        hal_linux_wav_in(const char *file);
+bool        hal_linux_wav_out(const char *file);
+
+// Call fn every period_us of simulated time, from the mock's event loop
+void        hal_linux_every(double period_us, void (*fn)(void));
+
+// For the summary at the end
+struct HalLinuxStats
+{
+    uint64_t    blocks, late_blocks;
+    uint64_t    unacked;                                            // Blocks the handler left its interrupt raised
+    double      isr_us, isr_max_us;                                 // Host time in the handler
+    double      wall_us;
+    uint32_t    udp_out, udp_in;
+};
+HalLinuxStats hal_linux_stats(void);
@@ -0,0 +1,23 @@
+//////////////////////////////////////////////////////////////////////
+// Host stand in for hardware/spi.h, the bytes go to the mock W5500
+//
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct spi_inst spi_inst_t;
+
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len);
+int spi_read_blocking(spi_inst_t *spi, uint8_t repeated_tx_data, uint8_t *dst, size_t len);
+unsigned int spi_get_baudrate(const spi_inst_t *spi);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define spi0    ((spi_inst_t *)0)
@@ -0,0 +1,15 @@
+//////////////////////////////////////////////////////////////////////
+// Host stand in for hardware/sync.h, the spin lock dante_snoop.h puts
+// around the W5500.  The pipeline is one thread here, so it never waits.
+//
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef volatile uint32_t spin_lock_t;
+
+static inline int          spin_lock_claim_unused(bool required)   { (void)required; return 0; }
+static inline spin_lock_t *spin_lock_init(unsigned int num)         { static spin_lock_t lock[32]; return &lock[num]; }
+static inline void         spin_lock_unsafe_blocking(spin_lock_t *lock) { *lock = 1; }
+static inline void         spin_unlock_unsafe(spin_lock_t *lock)   { *lock = 0; }
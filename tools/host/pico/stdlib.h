@@ -0,0 +1,30 @@
+//////////////////////////////////////////////////////////////////////
+// Host stand in for the parts of the Pico SDK the network headers use
+//
+// Only what the network headers, the DSP headers and dante_snoop.h need to
+// build on Linux.  Time is the simulated time of the mock W5500, so the
+// jitter buffer sees the arrival times it would on the board, and the sleeps
+// move that clock on.
+//
+
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint64_t time_us_64(void);
+void     sleep_us(uint64_t us);
+void     sleep_ms(uint32_t ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define __not_in_flash_func(f)  f
+#define __scratch_x(s)
+#define __scratch_y(s)
+#define __dmb()                 __atomic_signal_fence(__ATOMIC_SEQ_CST)
@@ -0,0 +1,9 @@
+//////////////////////////////////////////////////////////////////////
+// Host stand in for the RP2040-HAT-C port_common.h
+//
+
+#pragma once
+#include "pico/stdlib.h"
+#include "hardware/spi.h"
+
+#define SPI_PORT    spi0
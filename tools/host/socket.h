@@ -0,0 +1,43 @@
+//////////////////////////////////////////////////////////////////////
+// Host stand in for the ioLibrary socket.h, the calls the firmware makes
+//
+// recvfrom() is always non blocking, as every socket the firmware opens is.
+//
+// The names are those of POSIX, so a process that also has real sockets,
+// as pipeline_host does, would have them taken over by these at link time.
+// They are renamed here, and mock_w5500.cpp defines them under the new
+// names.  A file that includes this can't use the POSIX calls.
+//
+
+#pragma once
+#include "wizchip_conf.h"
+
+#define SOCK_OK             1
+#define SOCK_BUSY           0
+#define SOCKERR_SOCKNUM     (-1)
+#define SOCKERR_SOCKSTATUS  (-7)
+#define SOCKERR_TIMEOUT     (-13)
+#define SF_IO_NONBLOCK      0x01
+#define SF_MULTI_ENABLE     Sn_MR_MULTI
+
+#define socket      wiz_socket
+#define close       wiz_close
+#define listen      wiz_listen
+#define disconnect  wiz_disconnect
+#define sendto      wiz_sendto
+#define recvfrom    wiz_recvfrom
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int8_t  socket(uint8_t sn, uint8_t protocol, uint16_t port, uint8_t flag);
+int8_t  close(uint8_t sn);
+int8_t  listen(uint8_t sn);
+int8_t  disconnect(uint8_t sn);
+int32_t sendto(uint8_t sn, uint8_t *buf, uint16_t len, uint8_t *addr, uint16_t port);
+int32_t recvfrom(uint8_t sn, uint8_t *buf, uint16_t len, uint8_t *addr, uint16_t *port);
+
+#ifdef __cplusplus
+}
+#endif
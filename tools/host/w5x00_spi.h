@@ -0,0 +1,24 @@
+//////////////////////////////////////////////////////////////////////
+// Host stand in for the RP2040-HAT-C w5x00_spi.h
+//
+// There is no chip to reset.  network_initialize() sets the address
+// registers of the mock, which is where the loopback bridge of
+// tools/hal_linux.cpp finds the board's own address.
+//
+
+#pragma once
+#include "wizchip_conf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void wizchip_spi_initialize(void);
+void wizchip_cris_initialize(void);
+void wizchip_reset(void);
+void wizchip_initialize(void);
+void network_initialize(wiz_NetInfo net_info);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,147 @@
+//////////////////////////////////////////////////////////////////////
+// Host stand in for the ioLibrary wizchip_conf.h and w5500.h
+//
+// The register access macros are the ioLibrary ones, one SPI transaction
+// per WIZCHIP_READ() or WIZCHIP_WRITE(), so the mock counts the same SPI
+// traffic as the board makes.  Only the registers the firmware uses are
+// here.  The functions are in tools/mock_w5500.cpp.
+//
+// The common registers are only the address ones, which ctlnetwork() and
+// network_initialize() set and read back.
+//
+
+#pragma once
+#include <stdint.h>
+
+#define _W5500_SPI_READ_            (0x00 << 2)
+#define _W5500_SPI_WRITE_           (0x01 << 2)
+#define _W5500_SPI_VDM_OP_          0x00
+
+#define WIZCHIP_CREG_BLOCK          0x00
+#define WIZCHIP_SREG_BLOCK(N)       (1 + 4*(N))
+#define WIZCHIP_TXBUF_BLOCK(N)      (2 + 4*(N))
+#define WIZCHIP_RXBUF_BLOCK(N)      (3 + 4*(N))
+#define WIZCHIP_OFFSET_INC(ADDR, N) ((ADDR) + ((N) << 8))
+
+#define _CREG_(A)                   ((uint32_t)(A) << 8)
+#define GAR                         _CREG_(0x0001)
+#define SUBR                        _CREG_(0x0005)
+#define SHAR                        _CREG_(0x0009)
+#define SIPR                        _CREG_(0x000F)
+#define VERSIONR                    _CREG_(0x0039)
+
+#define _SREG_(N, A)                (((uint32_t)(A) << 8) + (WIZCHIP_SREG_BLOCK(N) << 3))
+#define Sn_MR(N)                    _SREG_(N, 0x0000)
+#define Sn_CR(N)                    _SREG_(N, 0x0001)
+#define Sn_IR(N)                    _SREG_(N, 0x0002)
+#define Sn_SR(N)                    _SREG_(N, 0x0003)
+#define Sn_PORT(N)                  _SREG_(N, 0x0004)
+#define Sn_DHAR(N)                  _SREG_(N, 0x0006)
+#define Sn_DIPR(N)                  _SREG_(N, 0x000C)
+#define Sn_DPORT(N)                 _SREG_(N, 0x0010)
+#define Sn_RXBUF_SIZE(N)            _SREG_(N, 0x001E)
+#define Sn_TXBUF_SIZE(N)            _SREG_(N, 0x001F)
+#define Sn_TX_FSR(N)                _SREG_(N, 0x0020)
+#define Sn_TX_RD(N)                 _SREG_(N, 0x0022)
+#define Sn_TX_WR(N)                 _SREG_(N, 0x0024)
+#define Sn_RX_RSR(N)                _SREG_(N, 0x0026)
+#define Sn_RX_RD(N)                 _SREG_(N, 0x0028)
+#define Sn_RX_WR(N)                 _SREG_(N, 0x002A)
+
+#define Sn_MR_TCP                   0x01
+#define Sn_MR_UDP                   0x02
+#define Sn_MR_MULTI                 0x80
+
+#define Sn_CR_OPEN                  0x01
+#define Sn_CR_LISTEN                0x02
+#define Sn_CR_CONNECT               0x04
+#define Sn_CR_DISCON                0x08
+#define Sn_CR_CLOSE                 0x10
+#define Sn_CR_SEND                  0x20
+#define Sn_CR_RECV                  0x40
+
+#define Sn_IR_CON                   0x01
+#define Sn_IR_DISCON                0x02
+#define Sn_IR_RECV                  0x04
+#define Sn_IR_TIMEOUT               0x08
+#define Sn_IR_SENDOK                0x10
+
+#define SOCK_CLOSED                 0x00
+#define SOCK_INIT                   0x13
+#define SOCK_LISTEN                 0x14
+#define SOCK_ESTABLISHED            0x17
+#define SOCK_CLOSE_WAIT             0x1C
+#define SOCK_UDP                    0x22
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum { NETINFO_STATIC = 1, NETINFO_DHCP } dhcp_mode;
+
+typedef struct wiz_NetInfo_t
+{
+    uint8_t     mac[6];
+    uint8_t     ip[4];
+    uint8_t     sn[4];
+    uint8_t     gw[4];
+    uint8_t     dns[4];
+    dhcp_mode   dhcp;
+} wiz_NetInfo;
+
+typedef enum { CN_SET_NETINFO, CN_GET_NETINFO } ctlnetwork_type;
+
+typedef struct
+{
+    struct { void (*_enter)(void); void (*_exit)(void); } CRIS;
+    struct { void (*_select)(void); void (*_deselect)(void); } CS;
+    struct { struct { void (*_read_burst)(uint8_t *, uint16_t); void (*_write_burst)(uint8_t *, uint16_t); } SPI; } IF;
+} _WIZCHIP;
+
+extern _WIZCHIP WIZCHIP;
+
+void     reg_wizchip_cris_cbfunc(void (*cris_en)(void), void (*cris_ex)(void));
+
+uint8_t  WIZCHIP_READ(uint32_t addr);
+void     WIZCHIP_WRITE(uint32_t addr, uint8_t wb);
+void     WIZCHIP_READ_BUF(uint32_t addr, uint8_t *buf, uint16_t len);
+void     WIZCHIP_WRITE_BUF(uint32_t addr, uint8_t *buf, uint16_t len);
+
+uint16_t getSn_TX_FSR(uint8_t sn);
+uint16_t getSn_RX_RSR(uint8_t sn);
+void     wiz_send_data(uint8_t sn, uint8_t *wizdata, uint16_t len);
+void     wiz_recv_data(uint8_t sn, uint8_t *wizdata, uint16_t len);
+void     wiz_recv_ignore(uint8_t sn, uint16_t len);
+int8_t   ctlnetwork(ctlnetwork_type cntype, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define WIZCHIP_CRITICAL_ENTER()    WIZCHIP.CRIS._enter()
+#define WIZCHIP_CRITICAL_EXIT()     WIZCHIP.CRIS._exit()
+
+#define _GET16(A)       (((uint16_t)WIZCHIP_READ(A) << 8) + WIZCHIP_READ(WIZCHIP_OFFSET_INC(A, 1)))
+#define _SET16(A, V)    do { WIZCHIP_WRITE(A, (uint8_t)((V) >> 8)); WIZCHIP_WRITE(WIZCHIP_OFFSET_INC(A, 1), (uint8_t)(V)); } while (0)
+
+#define getSn_MR(sn)            WIZCHIP_READ(Sn_MR(sn))
+#define setSn_MR(sn, v)         WIZCHIP_WRITE(Sn_MR(sn), v)
+#define getSn_CR(sn)            WIZCHIP_READ(Sn_CR(sn))
+#define setSn_CR(sn, v)         WIZCHIP_WRITE(Sn_CR(sn), v)
+#define getSn_IR(sn)            (WIZCHIP_READ(Sn_IR(sn)) & 0x1F)
+#define setSn_IR(sn, v)         WIZCHIP_WRITE(Sn_IR(sn), (v) & 0x1F)
+#define getSn_SR(sn)            WIZCHIP_READ(Sn_SR(sn))
+#define setSn_PORT(sn, v)       _SET16(Sn_PORT(sn), v)
+#define setSn_DHAR(sn, p)       WIZCHIP_WRITE_BUF(Sn_DHAR(sn), p, 6)
+#define setSn_DIPR(sn, p)       WIZCHIP_WRITE_BUF(Sn_DIPR(sn), p, 4)
+#define getSn_DIPR(sn, p)       WIZCHIP_READ_BUF(Sn_DIPR(sn), p, 4)
+#define setSn_DPORT(sn, v)      _SET16(Sn_DPORT(sn), v)
+#define getSn_DPORT(sn)         _GET16(Sn_DPORT(sn))
+#define getSn_TX_RD(sn)         _GET16(Sn_TX_RD(sn))
+#define getSn_TX_WR(sn)         _GET16(Sn_TX_WR(sn))
+#define setSn_TX_WR(sn, v)      _SET16(Sn_TX_WR(sn), v)
+#define getSn_RX_RD(sn)         _GET16(Sn_RX_RD(sn))
+#define setSn_RX_RD(sn, v)      _SET16(Sn_RX_RD(sn), v)
+#define getSn_RX_WR(sn)         _GET16(Sn_RX_WR(sn))
+#define setSn_RXBUF_SIZE(sn, v) WIZCHIP_WRITE(Sn_RXBUF_SIZE(sn), v)
+#define setSn_TXBUF_SIZE(sn, v) WIZCHIP_WRITE(Sn_TXBUF_SIZE(sn), v)
@@ -0,0 +1,173 @@
+//////////////////////////////////////////////////////////////////////
+// Bit exactness and speed of the L24 kernels in l24.h against the byte loop
+//
+//   l24_bench [iterations]
+//
+// Every alignment of the packed side, lengths either side of the groups of
+// four, a few shifts, and random maps and strides for l24_read() and
+// l24_write() are compared word for word and byte for byte with the plain
+// loop the firmware used before, including that nothing is written past the
+// end.  Then each is timed on an 8ch 1ms packet.  The times are for this
+// host, which has unaligned loads and a barrel shifter the M0+ lacks, so
+// they show the ratio more than what it costs on the board.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <random>
+#include "l24.h"
+
+static std::mt19937 rng(1);
+
+// The loops that jb_write() and rtp_tx_push() had
+__attribute__((noinline)) static void naive_read(int32_t *dst, int dst_ch, const uint8_t *payload, int nch, const int8_t *map, int frames, int shift)
+{
+    for (int c = 0; c < dst_ch; c++)
+    {
+        int src = map ? map[c] : c;
+        if (src < 0 || src >= nch)
+        {
+            for (int f = 0; f < frames; f++) dst[f * dst_ch + c] = 0;
+            continue;
+        }
+        const uint8_t *p = payload + 3 * src;
+        for (int f = 0; f < frames; f++)
+        {
+            dst[f * dst_ch + c] = (int32_t)((p[0] << 24) | (p[1] << 16) | (p[2] << 8)) >> shift;
+            p += 3 * nch;
+        }
+    }
+}
+
+__attribute__((noinline)) static void naive_write(uint8_t *p, const int32_t *in, int stride, int nch, int frames, int shift)
+{
+    for (int m = 0; m < frames; m++)
+    {
+        for (int c = 0; c < nch; c++)
+        {
+            int32_t s = (uint32_t)in[c] << shift;
+            *p++ = s >> 24;
+            *p++ = s >> 16;
+            *p++ = s >> 8;
+        }
+        in += stride;
+    }
+}
+
+static void fill(void *p, int bytes)
+{
+    for (int i = 0; i < bytes; i++) ((uint8_t *)p)[i] = rng();
+}
+
+static int check(void)
+{
+    static uint8_t  bytes[2][4096] __attribute__((aligned(4)));
+    static int32_t  words[2][1024];
+    static int32_t  src[1024];
+    const int shifts[] = { 0, 8, 12 };
+    int tests = 0, fails = 0;
+
+    // The kernels on their own, each alignment and length
+    for (int shift : shifts)
+    for (int off = 0; off < 4; off++)
+    for (int n = 0; n <= 41; n++)
+    {
+        fill(bytes[0], sizeof(bytes[0]));
+        for (int k = 0; k < 2; k++) memset(words[k], 0x5A, sizeof(words[k]));
+        l24_unpack(words[0], bytes[0] + off, n, shift);
+        for (int i = 0; i < n; i++) words[1][i] = l24_get(bytes[0] + off + 3 * i, shift);
+        tests++;
+        if (memcmp(words[0], words[1], sizeof(words[0]))) { fails++; printf("FAIL unpack off %d n %d shift %d\n", off, n, shift); }
+
+        fill(src, sizeof(src));
+        for (int k = 0; k < 2; k++) memset(bytes[k], 0xA5, sizeof(bytes[k]));
+        l24_pack(bytes[0] + off, src, n, shift);
+        for (int i = 0; i < n; i++) l24_put(bytes[1] + off + 3 * i, src[i], shift);
+        tests++;
+        if (memcmp(bytes[0], bytes[1], sizeof(bytes[0]))) { fails++; printf("FAIL pack off %d n %d shift %d\n", off, n, shift); }
+    }
+
+    // Frames with maps and strides, against the old loops
+    for (int t = 0; t < 20000; t++)
+    {
+        int shift  = shifts[rng() % 3];
+        int off    = rng() % 4;
+        int nch    = 1 + rng() % 16;
+        int dst_ch = 1 + rng() % 16;
+        int frames = 1 + rng() % 48;
+        int8_t map[16];
+        bool use_map = rng() % 4;
+        int base = rng() % 16;
+        for (int c = 0; c < 16; c++)
+        {
+            switch (rng() % 4)
+            {
+                case 0:  map[c] = rng() % 20 - 2; break;           // Anything, some silent or past the end
+                default: map[c] = base + c;       break;           // Runs in order
+            }
+        }
+
+        fill(bytes[0], sizeof(bytes[0]));
+        for (int k = 0; k < 2; k++) memset(words[k], 0x5A, sizeof(words[k]));
+        l24_read(words[0], dst_ch, bytes[0] + off, nch, use_map ? map : nullptr, frames, shift);
+        naive_read(words[1], dst_ch, bytes[0] + off, nch, use_map ? map : nullptr, frames, shift);
+        tests++;
+        if (memcmp(words[0], words[1], sizeof(words[0]))) { fails++; printf("FAIL read nch %d dst_ch %d frames %d shift %d\n", nch, dst_ch, frames, shift); }
+
+        int stride = nch + (rng() % 2 ? 0 : rng() % 4);
+        fill(src, sizeof(src));
+        for (int k = 0; k < 2; k++) memset(bytes[k], 0xA5, sizeof(bytes[k]));
+        l24_write(bytes[0] + off, src, stride, nch, frames, shift);
+        naive_write(bytes[1] + off, src, stride, nch, frames, shift);
+        tests++;
+        if (memcmp(bytes[0], bytes[1], sizeof(bytes[0]))) { fails++; printf("FAIL write nch %d stride %d frames %d shift %d\n", nch, stride, frames, shift); }
+    }
+
+    printf("%s %d of %d\n", fails ? "FAIL" : "PASS", tests - fails, tests);
+    return fails;
+}
+
+static double now_ns(void)
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+#define TIME(name, call)                                                                    \
+    {                                                                                       \
+        double t0 = now_ns();                                                               \
+        for (int i = 0; i < iters; i++) { call; __asm__ volatile("" ::: "memory"); }        \
+        double ns = (now_ns() - t0) / iters / samples;                                      \
+        printf("  %-34s %6.2f ns/sample\n", name, ns);                                      \
+    }
+
+static void bench(int iters)
+{
+    const int nch = 8, frames = 48, samples = nch * frames;
+    static uint8_t payload[3 * nch * frames] __attribute__((aligned(4)));
+    static int32_t audio[frames][8], tdm[frames][8];
+    const int8_t four[8] = { 4, 5, 6, 7, -1, -1, -1, -1 };          // Half of a flow picked out
+    fill(payload, sizeof(payload));
+    fill(tdm, sizeof(tdm));
+
+    printf("8ch x 48 frames, %d iterations, on this host\n", iters);
+    TIME("receive, byte loop",              naive_read(audio[0], 8, payload, nch, nullptr, frames, 0));
+    TIME("receive, l24_read",               l24_read(audio[0], 8, payload, nch, nullptr, frames, 0));
+    TIME("receive 4 of 8, byte loop",       naive_read(audio[0], 8, payload, nch, four, frames, 0));
+    TIME("receive 4 of 8, l24_read",        l24_read(audio[0], 8, payload, nch, four, frames, 0));
+    TIME("transmit, byte loop",             naive_write(payload, tdm[0], 8, nch, frames, 0));
+    TIME("transmit, l24_write",             l24_write(payload, tdm[0], 8, nch, frames, 0));
+    TIME("transmit 6 of 8, byte loop",      naive_write(payload, tdm[0], 8, 6, frames, 0));
+    TIME("transmit 6 of 8, l24_write",      l24_write(payload, tdm[0], 8, 6, frames, 0));
+}
+
+int main(int argc, char **argv)
+{
+    int iters = argc > 1 ? atoi(argv[1]) : 200000;
+    int fails = check();
+    bench(iters);
+    return fails ? 1 : 0;
+}
@@ -0,0 +1,457 @@
+//////////////////////////////////////////////////////////////////////
+// The mock W5500, and the ioLibrary and SDK calls from tools/host
+//
+// No <unistd.h> or <sys/socket.h> in here, as the ioLibrary names close(),
+// socket() and the rest for its own calls, see tools/host/socket.h.
+//
+
+#include <string.h>
+#include "mock_w5500.h"
+#include "port_common.h"
+#include "wizchip_conf.h"
+#include "w5x00_spi.h"
+#include "socket.h"
+#include "pico/unique_id.h"
+
+MockW5500 mock;
+
+static void cris_none(void) { }
+static void cs_select(void);
+static void cs_deselect(void);
+
+extern "C" {
+_WIZCHIP WIZCHIP = { { cris_none, cris_none }, { cs_select, cs_deselect }, { { nullptr, nullptr } } };
+}
+
+
+void mock_reset(double spi_hz, double txn_us)
+{
+    auto wire = mock.wire;
+    auto next = mock.next_event;
+    auto run  = mock.run_event;
+    memset(&mock, 0, sizeof(mock));
+    mock.spi_hz = spi_hz;
+    mock.txn_us = txn_us;
+    mock.wire = wire;
+    mock.next_event = next;
+    mock.run_event  = run;
+    for (int s = 0; s < MOCK_SOCKETS; s++)
+    {
+        MockSocket &k = mock.sock[s];
+        k.rx_size = k.tx_size = 2048;                               // The default split, 2k each
+        k.reg[0x1E] = k.reg[0x1F] = 2;
+    }
+}
+
+// Move the clock on, running any events that fall due on the way
+void mock_advance(double us)
+{
+    double end = mock.now + us;
+    while (mock.next_event && mock.run_event)
+    {
+        double t = mock.next_event();
+        if (t > end) break;
+        if (t > mock.now) mock.now = t;
+        end += mock.run_event();                                    // An interrupt holds up whatever it interrupted
+    }
+    mock.now = end;
+}
+
+bool mock_deliver(const uint8_t dst_ip[4], int dst_port, const uint8_t src_ip[4], int src_port, const uint8_t *data, int len)
+{
+    for (int s = 0; s < MOCK_SOCKETS; s++)
+    {
+        MockSocket &k = mock.sock[s];
+        if (k.reg[0x03] != SOCK_UDP) continue;
+        if (((k.reg[0x04] << 8) | k.reg[0x05]) != dst_port) continue;
+        if ((k.reg[0x00] & Sn_MR_MULTI) && memcmp(&k.reg[0x0C], dst_ip, 4)) continue;
+
+        uint16_t used = k.rx_wr - k.rx_done;
+        if (used + 8 + len > k.rx_size) { k.dropped++; return false; }
+        uint8_t head[8] = { src_ip[0], src_ip[1], src_ip[2], src_ip[3],
+                            (uint8_t)(src_port >> 8), (uint8_t)src_port, (uint8_t)(len >> 8), (uint8_t)len };
+        for (int i = 0; i < 8; i++)   k.rx[(k.rx_wr++) & (k.rx_size - 1)] = head[i];
+        for (int i = 0; i < len; i++) k.rx[(k.rx_wr++) & (k.rx_size - 1)] = data[i];
+        k.delivered++;
+        used += 8 + len;
+        if (used > k.rsr_max) k.rsr_max = used;
+        return true;
+    }
+    return false;
+}
+
+
+static void command(int s, uint8_t cr)
+{
+    MockSocket &k = mock.sock[s];
+    switch (cr)
+    {
+        case Sn_CR_OPEN:
+            k.rx_wr = k.rx_rd = k.rx_done = 0;
+            k.tx_wr = k.tx_rd = 0;
+            k.reg[0x03] = (k.reg[0x00] & 0x0F) == Sn_MR_UDP ? SOCK_UDP : (k.reg[0x00] & 0x0F) == Sn_MR_TCP ? SOCK_INIT : SOCK_CLOSED;
+            break;
+        case Sn_CR_LISTEN:
+            if (k.reg[0x03] == SOCK_INIT) k.reg[0x03] = SOCK_LISTEN;
+            break;
+        case Sn_CR_DISCON:
+        case Sn_CR_CLOSE:
+            k.reg[0x03] = SOCK_CLOSED;
+            break;
+        case Sn_CR_RECV:
+            k.rx_done = k.rx_rd;
+            break;
+        case Sn_CR_SEND:
+        {
+            int len = (uint16_t)(k.tx_wr - k.tx_rd);
+            static uint8_t buf[16384];
+            for (int i = 0; i < len; i++) buf[i] = k.tx[(k.tx_rd + i) & (k.tx_size - 1)];
+            k.tx_rd = k.tx_wr;
+            k.sent++;
+            if (mock.wire && k.reg[0x03] == SOCK_UDP) mock.wire(s, &k.reg[0x0C], (k.reg[0x10] << 8) | k.reg[0x11], buf, len);
+            k.reg[0x02] |= Sn_IR_SENDOK;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static uint8_t reg_read(int s, int a)
+{
+    MockSocket &k = mock.sock[s];
+    uint16_t v;
+    switch (a & ~1)
+    {
+        case 0x20: v = k.tx_size - (uint16_t)(k.tx_wr - k.tx_rd); break;
+        case 0x22: v = k.tx_rd;                                   break;
+        case 0x24: v = k.tx_wr;                                   break;
+        case 0x26: v = k.rx_wr - k.rx_done;                       break;
+        case 0x28: v = k.rx_rd;                                   break;
+        case 0x2A: v = k.rx_wr;                                   break;
+        default:   return a == 0x01 ? 0 : k.reg[a];                // Commands are done at once
+    }
+    return a & 1 ? (uint8_t)v : (uint8_t)(v >> 8);
+}
+
+static void reg_write(int s, int a, uint8_t b)
+{
+    MockSocket &k = mock.sock[s];
+    uint16_t *p = (a & ~1) == 0x24 ? &k.tx_wr : (a & ~1) == 0x28 ? &k.rx_rd : nullptr;
+    if (p) *p = a & 1 ? (*p & 0xFF00) | b : (*p & 0x00FF) | (b << 8);
+    else if (a == 0x01) command(s, b);
+    else if (a == 0x02) k.reg[a] &= ~b;                             // Write 1 to clear
+    else if (a == 0x1E) { k.reg[a] = b; k.rx_size = (b > 16 ? 16 : b) * 1024; }    // In k, takes effect at once
+    else if (a == 0x1F) { k.reg[a] = b; k.tx_size = (b > 16 ? 16 : b) * 1024; }
+    else if (a < 0x30)  k.reg[a] = b;
+}
+
+// One byte of the data phase of a frame
+static uint8_t frame_byte(uint8_t b)
+{
+    int s = (mock.block - 1) / 4, kind = (mock.block - 1) % 4;
+    uint16_t a = mock.addr++;
+    uint8_t r = 0;
+    if (mock.block == WIZCHIP_CREG_BLOCK)
+    {
+        if (a == 0x39)                      r = 0x04;               // VERSIONR
+        else if (a >= 0x01 && a < 0x13)                             // GAR to SIPR
+        {
+            if (mock.write) mock.creg[a] = b;
+            else            r = mock.creg[a];
+        }
+    }
+    else if (s < MOCK_SOCKETS && kind == 0 && a < 0x30)
+    {
+        if (mock.write) reg_write(s, a, b);
+        else            r = reg_read(s, a);
+    }
+    else if (s < MOCK_SOCKETS && kind == 1)
+    {
+        MockSocket &k = mock.sock[s];
+        if (mock.write) k.tx[a & (k.tx_size - 1)] = b;
+        else            r = k.tx[a & (k.tx_size - 1)];
+    }
+    else if (s < MOCK_SOCKETS && kind == 2)
+    {
+        MockSocket &k = mock.sock[s];
+        if (k.rx_size) r = k.rx[a & (k.rx_size - 1)];
+    }
+    return r;
+}
+
+static void frame_header(uint8_t b)
+{
+    if (mock.phase == 0) mock.addr = b << 8;
+    if (mock.phase == 1) mock.addr |= b;
+    if (mock.phase == 2) { mock.block = b >> 3; mock.write = (b & _W5500_SPI_WRITE_) != 0; }
+    mock.phase++;
+}
+
+static void cs_select(void)
+{
+    mock.selected = true;
+    mock.phase = 0;
+    mock.frame_bytes = 0;
+}
+
+static void cs_deselect(void)
+{
+    mock.selected = false;
+    mock.txns++;
+    mock.bytes += mock.frame_bytes;
+    double us = mock.txn_us + mock.frame_bytes * 8e6 / mock.spi_hz;
+    mock.spi_us += us;
+    mock_advance(us);
+}
+
+
+extern "C" {
+
+uint64_t time_us_64(void)
+{
+    return (uint64_t)mock.now;
+}
+
+void sleep_us(uint64_t us)
+{
+    mock_advance(us);
+}
+
+void sleep_ms(uint32_t ms)
+{
+    mock_advance(ms * 1000.0);
+}
+
+void pico_get_unique_board_id(pico_unique_board_id_t *id_out)
+{
+    static const uint8_t id[PICO_UNIQUE_BOARD_ID_SIZE_BYTES] = { 0xE6, 0x60, 0x58, 0x38, 0x83, 0x1A, 0x2B, 0x33 };
+    memcpy(id_out->id, id, sizeof(id));
+}
+
+unsigned int spi_get_baudrate(const spi_inst_t *)
+{
+    return (unsigned int)mock.spi_hz;
+}
+
+int spi_write_blocking(spi_inst_t *, const uint8_t *src, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (mock.phase < 3) frame_header(src[i]);
+        else                frame_byte(src[i]);
+    }
+    mock.frame_bytes += len;
+    return len;
+}
+
+int spi_read_blocking(spi_inst_t *, uint8_t repeated_tx_data, uint8_t *dst, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (mock.phase < 3) { frame_header(repeated_tx_data); dst[i] = 0; }
+        else                dst[i] = frame_byte(repeated_tx_data);
+    }
+    mock.frame_bytes += len;
+    return len;
+}
+
+
+// The ioLibrary register access, one frame each
+uint8_t WIZCHIP_READ(uint32_t addr)
+{
+    uint8_t head[3] = { (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)(addr | _W5500_SPI_READ_ | _W5500_SPI_VDM_OP_) }, b;
+    cs_select();
+    spi_write_blocking(SPI_PORT, head, 3);
+    spi_read_blocking(SPI_PORT, 0, &b, 1);
+    cs_deselect();
+    return b;
+}
+
+void WIZCHIP_WRITE(uint32_t addr, uint8_t wb)
+{
+    uint8_t frame[4] = { (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)(addr | _W5500_SPI_WRITE_ | _W5500_SPI_VDM_OP_), wb };
+    cs_select();
+    spi_write_blocking(SPI_PORT, frame, 4);
+    cs_deselect();
+}
+
+void WIZCHIP_READ_BUF(uint32_t addr, uint8_t *buf, uint16_t len)
+{
+    uint8_t head[3] = { (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)(addr | _W5500_SPI_READ_ | _W5500_SPI_VDM_OP_) };
+    cs_select();
+    spi_write_blocking(SPI_PORT, head, 3);
+    spi_read_blocking(SPI_PORT, 0, buf, len);
+    cs_deselect();
+}
+
+void WIZCHIP_WRITE_BUF(uint32_t addr, uint8_t *buf, uint16_t len)
+{
+    uint8_t head[3] = { (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)(addr | _W5500_SPI_WRITE_ | _W5500_SPI_VDM_OP_) };
+    cs_select();
+    spi_write_blocking(SPI_PORT, head, 3);
+    spi_write_blocking(SPI_PORT, buf, len);
+    cs_deselect();
+}
+
+// As the ioLibrary, read until two reads agree
+uint16_t getSn_TX_FSR(uint8_t sn)
+{
+    uint16_t val = 0, val1 = 0;
+    do
+    {
+        val1 = _GET16(Sn_TX_FSR(sn));
+        if (val1 != 0) val = _GET16(Sn_TX_FSR(sn));
+    } while (val != val1);
+    return val;
+}
+
+uint16_t getSn_RX_RSR(uint8_t sn)
+{
+    uint16_t val = 0, val1 = 0;
+    do
+    {
+        val1 = _GET16(Sn_RX_RSR(sn));
+        if (val1 != 0) val = _GET16(Sn_RX_RSR(sn));
+    } while (val != val1);
+    return val;
+}
+
+void wiz_send_data(uint8_t sn, uint8_t *wizdata, uint16_t len)
+{
+    if (len == 0) return;
+    uint16_t ptr = getSn_TX_WR(sn);
+    WIZCHIP_WRITE_BUF(((uint32_t)ptr << 8) + (WIZCHIP_TXBUF_BLOCK(sn) << 3), wizdata, len);
+    setSn_TX_WR(sn, ptr + len);
+}
+
+void wiz_recv_data(uint8_t sn, uint8_t *wizdata, uint16_t len)
+{
+    if (len == 0) return;
+    uint16_t ptr = getSn_RX_RD(sn);
+    WIZCHIP_READ_BUF(((uint32_t)ptr << 8) + (WIZCHIP_RXBUF_BLOCK(sn) << 3), wizdata, len);
+    setSn_RX_RD(sn, ptr + len);
+}
+
+void wiz_recv_ignore(uint8_t sn, uint16_t len)
+{
+    uint16_t ptr = getSn_RX_RD(sn);
+    setSn_RX_RD(sn, ptr + len);
+}
+
+
+// The RP2040-HAT-C set up, nothing to do but the addresses
+void wizchip_spi_initialize(void)  { }
+void wizchip_cris_initialize(void) { }
+
+void reg_wizchip_cris_cbfunc(void (*cris_en)(void), void (*cris_ex)(void))
+{
+    WIZCHIP.CRIS._enter = cris_en;
+    WIZCHIP.CRIS._exit  = cris_ex;
+}
+void wizchip_reset(void)           { }
+void wizchip_initialize(void)      { }
+
+void network_initialize(wiz_NetInfo net_info)
+{
+    ctlnetwork(CN_SET_NETINFO, &net_info);
+}
+
+int8_t ctlnetwork(ctlnetwork_type cntype, void *arg)
+{
+    static dhcp_mode dhcp = NETINFO_STATIC;                         // Kept by the ioLibrary, not the chip
+    wiz_NetInfo *n = (wiz_NetInfo *)arg;
+    switch (cntype)
+    {
+        case CN_SET_NETINFO:
+            WIZCHIP_WRITE_BUF(SHAR, n->mac, 6);
+            WIZCHIP_WRITE_BUF(GAR,  n->gw,  4);
+            WIZCHIP_WRITE_BUF(SUBR, n->sn,  4);
+            WIZCHIP_WRITE_BUF(SIPR, n->ip,  4);
+            dhcp = n->dhcp;
+            return 0;
+        case CN_GET_NETINFO:
+            WIZCHIP_READ_BUF(SHAR, n->mac, 6);
+            WIZCHIP_READ_BUF(GAR,  n->gw,  4);
+            WIZCHIP_READ_BUF(SUBR, n->sn,  4);
+            WIZCHIP_READ_BUF(SIPR, n->ip,  4);
+            n->dhcp = dhcp;
+            return 0;
+    }
+    return -1;
+}
+
+
+int8_t close(uint8_t sn)
+{
+    if (sn >= MOCK_SOCKETS) return SOCKERR_SOCKNUM;
+    setSn_CR(sn, Sn_CR_CLOSE);
+    while (getSn_CR(sn));
+    setSn_IR(sn, 0xFF);
+    while (getSn_SR(sn) != SOCK_CLOSED);
+    return SOCK_OK;
+}
+
+int8_t socket(uint8_t sn, uint8_t protocol, uint16_t port, uint8_t flag)
+{
+    if (sn >= MOCK_SOCKETS) return SOCKERR_SOCKNUM;
+    close(sn);
+    setSn_MR(sn, protocol | (flag & 0xF0));
+    setSn_PORT(sn, port);
+    setSn_CR(sn, Sn_CR_OPEN);
+    while (getSn_CR(sn));
+    while (getSn_SR(sn) == SOCK_CLOSED);
+    return sn;
+}
+
+int8_t listen(uint8_t sn)
+{
+    setSn_CR(sn, Sn_CR_LISTEN);
+    while (getSn_CR(sn));
+    return SOCK_OK;
+}
+
+int8_t disconnect(uint8_t sn)
+{
+    setSn_CR(sn, Sn_CR_DISCON);
+    while (getSn_CR(sn));
+    return SOCK_OK;
+}
+
+// As the ioLibrary for UDP, the datagram goes when SENDOK comes back
+int32_t sendto(uint8_t sn, uint8_t *buf, uint16_t len, uint8_t *addr, uint16_t port)
+{
+    if (sn >= MOCK_SOCKETS) return SOCKERR_SOCKNUM;
+    if (getSn_SR(sn) != SOCK_UDP) return SOCKERR_SOCKSTATUS;
+    setSn_DIPR(sn, addr);
+    setSn_DPORT(sn, port);
+    if (len > getSn_TX_FSR(sn)) return SOCK_BUSY;
+    wiz_send_data(sn, buf, len);
+    setSn_CR(sn, Sn_CR_SEND);
+    while (getSn_CR(sn));
+    while (!(getSn_IR(sn) & Sn_IR_SENDOK))
+        if (getSn_IR(sn) & Sn_IR_TIMEOUT) { setSn_IR(sn, Sn_IR_TIMEOUT); return SOCKERR_TIMEOUT; }
+    setSn_IR(sn, Sn_IR_SENDOK);
+    return len;
+}
+
+// One datagram, header then payload, anything past len is skipped
+int32_t recvfrom(uint8_t sn, uint8_t *buf, uint16_t len, uint8_t *addr, uint16_t *port)
+{
+    if (sn >= MOCK_SOCKETS) return SOCKERR_SOCKNUM;
+    if (getSn_SR(sn) != SOCK_UDP) return SOCKERR_SOCKSTATUS;
+    if (getSn_RX_RSR(sn) == 0) return SOCK_BUSY;
+    uint8_t head[8];
+    wiz_recv_data(sn, head, 8);
+    memcpy(addr, head, 4);
+    *port = (head[4] << 8) | head[5];
+    uint16_t size = (head[6] << 8) | head[7];
+    uint16_t take = size < len ? size : len;
+    wiz_recv_data(sn, buf, take);
+    if (size > take) wiz_recv_ignore(sn, size - take);
+    setSn_CR(sn, Sn_CR_RECV);
+    while (getSn_CR(sn));
+    return take;
+}
+
+}
@@ -0,0 +1,75 @@
+//////////////////////////////////////////////////////////////////////
+// A model of the W5500 at the SPI frame level, for running the firmware's
+// network code on the host
+//
+// The firmware headers build against the stand ins in tools/host, which send
+// every byte through spi_write_blocking() and spi_read_blocking() here.  Each
+// chip select is decoded as a W5500 frame, two address bytes and a control
+// byte of block, read/write and mode, then data with the address counting up.
+// The socket registers and RX/TX memory behave as the datasheet has it: RX_RSR
+// and TX_FSR are worked out from the pointers when read, commands take effect
+// when written to Sn_CR, Sn_RXBUF_SIZE resizes the RX memory, and a UDP
+// datagram that does not fit in the free RX
+// memory is dropped, with the 8 byte header of source IP, port and length in
+// front of each one that is kept.
+//
+// Time is simulated.  Each transaction costs txn_us, for the chip select and
+// the call, plus 8 bits per byte at spi_hz, and the clock only moves on with
+// SPI traffic or mock_advance().  The harness says when its next event is due
+// (a packet on the wire or an audio interrupt) and those are run at the right
+// time within a transaction, as on the board where the W5500 keeps receiving
+// and the ISR interrupts a long read.  An event can return time it took, which
+// is added on to the transaction it interrupted.
+//
+// TCP is only modelled far enough for sockets to open and close.  Of the
+// common registers only the addresses are kept, and VERSIONR.
+//
+
+#pragma once
+#include <stdint.h>
+
+#define MOCK_SOCKETS    8
+
+struct MockSocket
+{
+    uint8_t     reg[0x30];
+    uint8_t     rx[16384], tx[16384];
+    int         rx_size, tx_size;
+    uint16_t    rx_wr, rx_rd, rx_done;                              // rx_done is RX_RD as of the last RECV
+    uint16_t    tx_wr, tx_rd;
+
+    // Counters for the harness
+    uint32_t    delivered, dropped, sent;
+    uint32_t    rsr_max;                                            // Fullest the RX memory has been
+};
+
+struct MockW5500
+{
+    MockSocket  sock[MOCK_SOCKETS];
+    uint8_t     creg[0x40];                                         // Common registers, GAR, SUBR, SHAR and SIPR
+    double      spi_hz, txn_us;
+    double      now;                                                // Simulated time in us
+
+    // SPI frame being decoded
+    bool        selected;
+    int         phase;                                              // Header bytes seen
+    uint32_t    addr;
+    int         block;
+    bool        write;
+    uint32_t    frame_bytes;
+
+    // Totals since mock_reset()
+    uint64_t    txns, bytes;
+    double      spi_us;
+
+    // Supplied by the harness
+    double    (*next_event)(void);                                  // Time of the next event, or a large number
+    double    (*run_event)(void);                                   // Run it, returns the time it took
+    void      (*wire)(int sn, const uint8_t ip[4], int port, const uint8_t *data, int len);     // UDP sent by the firmware
+};
+
+extern MockW5500 mock;
+
+void    mock_reset(double spi_hz, double txn_us);
+void    mock_advance(double us);
+bool    mock_deliver(const uint8_t dst_ip[4], int dst_port, const uint8_t src_ip[4], int src_port, const uint8_t *data, int len);
@@ -0,0 +1,165 @@
+//////////////////////////////////////////////////////////////////////
+// Reading and writing the UDP packets of a classic pcap file
+//
+// Only what the replay needs.  IPv4 UDP in Ethernet (with or without a VLAN
+// tag), Linux cooked (v1 and v2), raw IP or BSD loopback captures, micro or
+// nanosecond timestamps, either byte order.  Fragments and anything else are
+// counted and skipped.  pcapng is not read, save as pcap from Wireshark or
+// use tcpdump -w.
+//
+
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+struct PcapPacket
+{
+    double                  t_us;                                   // From the start of the capture
+    uint8_t                 src[4], dst[4];
+    int                     sport, dport;
+    std::vector<uint8_t>    data;                                   // UDP payload
+};
+
+static inline uint32_t pcap_swap32(uint32_t v, bool swap)
+{
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+// Returns false if the file could not be read, skipped counts packets that were not IPv4 UDP
+static bool pcap_read(const char *file, std::vector<PcapPacket> &out, int &skipped)
+{
+    FILE *f = fopen(file, "rb");
+    if (!f) { perror(file); return false; }
+
+    uint32_t head[6];
+    if (fread(head, 4, 6, f) != 6) { fclose(f); return false; }
+    bool swap = false, nano = false;
+    switch (head[0])
+    {
+        case 0xA1B2C3D4: break;
+        case 0xA1B23C4D: nano = true; break;
+        case 0xD4C3B2A1: swap = true; break;
+        case 0x4D3CB2A1: swap = nano = true; break;
+        default:
+            fprintf(stderr, "%s is not a pcap file (pcapng is not read, save it as pcap)\n", file);
+            fclose(f);
+            return false;
+    }
+    uint32_t link = pcap_swap32(head[5], swap) & 0xFFFF;
+
+    skipped = 0;
+    double t0 = -1;
+    static uint8_t frame[262144];
+    uint32_t rec[4];
+    while (fread(rec, 4, 4, f) == 4)
+    {
+        uint32_t len = pcap_swap32(rec[2], swap);
+        if (len > sizeof(frame) || fread(frame, 1, len, f) != len) break;
+        double t = pcap_swap32(rec[0], swap) * 1e6 + pcap_swap32(rec[1], swap) * (nano ? 1e-3 : 1.0);
+        if (t0 < 0) t0 = t;
+
+        // Find the IP header for the link type
+        const uint8_t *p = frame;
+        int n = len, proto = 0x0800;
+        if (link == 1)                                              // Ethernet
+        {
+            if (n < 14) { skipped++; continue; }
+            proto = (p[12] << 8) | p[13];
+            p += 14; n -= 14;
+            if (proto == 0x8100 && n >= 4) { proto = (p[2] << 8) | p[3]; p += 4; n -= 4; }
+        }
+        else if (link == 113)                                       // Linux cooked
+        {
+            if (n < 16) { skipped++; continue; }
+            proto = (p[14] << 8) | p[15];
+            p += 16; n -= 16;
+        }
+        else if (link == 276)                                       // Linux cooked v2
+        {
+            if (n < 20) { skipped++; continue; }
+            proto = (p[0] << 8) | p[1];
+            p += 20; n -= 20;
+        }
+        else if (link == 0)                                         // BSD loopback
+        {
+            if (n < 4) { skipped++; continue; }
+            p += 4; n -= 4;
+        }
+        else if (link != 101 && link != 12)                         // Raw IP
+        {
+            fprintf(stderr, "link type %u is not read\n", link);
+            fclose(f);
+            return false;
+        }
+
+        if (proto != 0x0800 || n < 20 || (p[0] >> 4) != 4 || p[9] != 17) { skipped++; continue; }
+        int ihl = 4 * (p[0] & 0x0F);
+        int frag = ((p[6] << 8) | p[7]) & 0x3FFF;                   // More fragments or an offset
+        if (frag || n < ihl + 8) { skipped++; continue; }
+        const uint8_t *u = p + ihl;
+        int ulen = ((u[4] << 8) | u[5]) - 8;
+        if (ulen < 0 || ihl + 8 + ulen > n) { skipped++; continue; }
+
+        PcapPacket k;
+        k.t_us  = t - t0;
+        memcpy(k.src, p + 12, 4);
+        memcpy(k.dst, p + 16, 4);
+        k.sport = (u[0] << 8) | u[1];
+        k.dport = (u[2] << 8) | u[3];
+        k.data.assign(u + 8, u + 8 + ulen);
+        out.push_back(std::move(k));
+    }
+    fclose(f);
+    return true;
+}
+
+// Ethernet framing, multicast destinations get their group MAC
+static bool pcap_write(const char *file, const std::vector<PcapPacket> &pkts)
+{
+    FILE *f = fopen(file, "wb");
+    if (!f) { perror(file); return false; }
+    uint32_t head[6] = { 0xA1B2C3D4, 0x00040002, 0, 0, 65535, 1 };
+    fwrite(head, 4, 6, f);
+
+    for (const PcapPacket &k : pkts)
+    {
+        static uint8_t frame[65536];
+        int ulen = 8 + k.data.size(), ilen = 20 + ulen;
+        uint8_t *e = frame, *ip = frame + 14, *u = ip + 20;
+        bool multi = (k.dst[0] & 0xF0) == 0xE0;
+        uint8_t mac[6] = { 0x01, 0x00, 0x5E, (uint8_t)(k.dst[1] & 0x7F), k.dst[2], k.dst[3] };
+        uint8_t uni[6] = { 0x00, 0x08, 0xDC, 0x12, 0x34, 0x56 };
+        uint8_t src[6] = { 0x02, 0x00, k.src[0], k.src[1], k.src[2], k.src[3] };
+        memcpy(e, multi ? mac : uni, 6);
+        memcpy(e + 6, src, 6);
+        e[12] = 0x08; e[13] = 0x00;
+
+        memset(ip, 0, 20);
+        ip[0] = 0x45;
+        ip[2] = ilen >> 8; ip[3] = ilen;
+        ip[6] = 0x40;                                               // Don't fragment
+        ip[8] = 32;
+        ip[9] = 17;
+        memcpy(ip + 12, k.src, 4);
+        memcpy(ip + 16, k.dst, 4);
+        uint32_t sum = 0;
+        for (int i = 0; i < 20; i += 2) sum += (ip[i] << 8) | ip[i+1];
+        while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+        ip[10] = ~sum >> 8; ip[11] = ~sum;
+
+        u[0] = k.sport >> 8; u[1] = k.sport;
+        u[2] = k.dport >> 8; u[3] = k.dport;
+        u[4] = ulen >> 8;    u[5] = ulen;
+        u[6] = u[7] = 0;                                            // No checksum
+        memcpy(u + 8, k.data.data(), k.data.size());
+
+        uint64_t t = (uint64_t)k.t_us;
+        uint32_t rec[4] = { (uint32_t)(t / 1000000), (uint32_t)(t % 1000000), (uint32_t)(14 + ilen), (uint32_t)(14 + ilen) };
+        fwrite(rec, 4, 4, f);
+        fwrite(frame, 1, 14 + ilen, f);
+    }
+    fclose(f);
+    return true;
+}
@@ -0,0 +1,487 @@
+//////////////////////////////////////////////////////////////////////
+// Replay a capture through the firmware's receive path on the host
+//
+// The throughput figures in udp_test.h came from iperf runs against a board,
+// which can't be repeated in a regression.  This runs the real flows.h,
+// jitter.h, mixer.h and biquad.h against the mock W5500 of mock_w5500.h, and
+// feeds it the UDP packets of a pcap at the times they were captured.  The
+// audio ISR is run every ISR_BLOCK frames of 48kHz and reads the flows into
+// the mixer and EQ as dma_handler does.  Everything is in simulated time, so
+// the same capture gives the same numbers every time.
+//
+// The SPI is modelled as 36MHz with a fixed cost for each transaction, which
+// is all the time the network loop is charged for.  The time the firmware
+// spends parsing and converting samples is not counted, nor does anything
+// else in the loop (RTP transmit, telemetry) compete for the SPI.  So the
+// absolute numbers are a lower bound, and it is the difference between the
+// receive strategies on the same traffic that means most.  -x runs the
+// traffic faster than it was captured, which is done by making the SPI and
+// the ISR slower by the same factor so the audio clock and RTP timestamps
+// still agree, and shows how much headroom a strategy has.
+//
+// Receive strategies
+//
+//   fullest     flow_service() as in the firmware, the fullest socket is read
+//               in one burst and every whole datagram in it taken
+//   roundrobin  the same burst read, but of each socket in turn
+//   datagram    one datagram per read with the ioLibrary calls, as recvfrom()
+//               does, header then payload, each with a RECV
+//
+// For each it reports the packets the W5500 dropped for want of RX memory,
+// SPI transactions, bytes and time per packet, the time spent polling empty
+// sockets, how full the RX memory got, and the jitter buffer counters.  The
+// audio out of flows_read() is checked for continuity.  A step bigger than -k
+// times the largest step in the audio that was sent is counted as a click,
+// and blocks where a flow had stopped playing after it started are counted
+// as dropouts.
+//
+// With no capture to hand, --make writes one of L24 sine waves with
+// exponential arrival jitter, some loss and a sender clock 50ppm fast.
+//
+//   pcap_replay [options] capture.pcap
+//     -s fullest|roundrobin|datagram|all     strategy, default all
+//     -f group:port                          a flow to open, up to four, default the first RTP flows in the capture
+//     -x factor                              traffic this many times faster than captured
+//     --spi hz  --txn us  --isr us           SPI clock, cost of each transaction, and of each ISR
+//     -k factor                              click threshold, default 2
+//   pcap_replay --make out.pcap [seconds] [flows] [channels] [jitter_us] [loss_pct]
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#include "pico/stdlib.h"
+#include "mock_w5500.h"
+#include "pcap.h"
+#include "flows.h"
+#include "mixer.h"
+#include "biquad.h"
+
+#define ISR_BLOCK       4                                           // As in i2s_example.cpp
+#define ISR_PERIOD_US   (ISR_BLOCK * 1e6 / 48000)
+
+struct Options
+{
+    double      spi_hz   = 36e6;                                    // As udp_test.h was run
+    double      txn_us   = 0.5;
+    double      isr_us   = 0;
+    double      speed    = 1;
+    double      click    = 2;
+};
+
+struct Result
+{
+    const char *name;
+    uint32_t    sent, dropped, parsed;
+    uint64_t    payload, read_txns, read_bytes, poll_txns;
+    double      read_us, poll_us, elapsed_us;
+    uint32_t    rsr_max, rx_size;                                   // Fullest and size of the flow sockets' RX memory
+    uint32_t    late, lost, concealed, overflows;
+    uint32_t    clicks, dropouts;
+    double      dsp_ns, wall_s;
+};
+
+// The replay in progress
+static std::vector<PcapPacket>  packets;
+static size_t                   next_packet;
+static double                   next_isr, isr_cost;
+static uint64_t                 events;
+static int32_t                  out[ISR_BLOCK][JB_CHANNELS], last[JB_CHANNELS];
+static int32_t                  threshold[JB_CHANNELS];
+static bool                     started[FLOW_MAX];
+static uint32_t                 clicks, dropouts;
+static double                   dsp_ns;
+static uint64_t                 blocks;
+
+Mixer   mixer;
+Eq      eq;
+
+
+static double next_event(void)
+{
+    double t = next_packet < packets.size() ? packets[next_packet].t_us : 1e300;
+    return t < next_isr ? t : next_isr;
+}
+
+// The audio ISR, from flows_read() on, as dma_handler
+static void isr(void)
+{
+    flows_read(out[0], ISR_BLOCK);
+
+    for (int m = 0; m < ISR_BLOCK; m++)
+        for (int c = 0; c < JB_CHANNELS; c++)
+        {
+            int32_t step = (out[m][c] >> 8) - (last[c] >> 8);
+            if (blocks && (step > threshold[c] || -step > threshold[c])) clicks++;
+            last[c] = out[m][c];
+        }
+    for (int n = 0; n < FLOW_MAX; n++)
+    {
+        if (!flows[n].active) continue;
+        bool run = flows[n].jb.running;
+        if (run) started[n] = true;
+        else if (started[n]) dropouts++;
+    }
+
+    timespec a, b;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    static int32_t mix[ISR_BLOCK][MIX_CHANNELS];
+    const int32_t *pmix = mixer_process<MIX_DENSE, ISR_BLOCK>(mixer, out[0], mix[0]);
+    eq_swap(eq);
+    for (int c = 0; c < JB_CHANNELS; c++)
+    {
+        int32_t buf[ISR_BLOCK];
+        for (int m = 0; m < ISR_BLOCK; m++) buf[m] = pmix[8*m + c] >> 8;
+        eq_process(eq, c, buf, ISR_BLOCK);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    dsp_ns += (b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec);
+    blocks++;
+}
+
+static double run_event(void)
+{
+    events++;
+    if (next_packet < packets.size() && packets[next_packet].t_us <= next_isr)
+    {
+        const PcapPacket &k = packets[next_packet++];
+        mock_deliver(k.dst, k.dport, k.src, k.sport, k.data.data(), k.data.size());
+        return 0;
+    }
+    next_isr += ISR_PERIOD_US;
+    isr();
+    return isr_cost;
+}
+
+
+// As flow_service(), but each socket in turn
+static int rx_roundrobin(void)
+{
+    static int next;
+    for (int i = 0; i < FLOW_MAX; i++)
+    {
+        int n = (next + i) % FLOW_MAX;
+        if (!flows[n].active) continue;
+        next = n + 1;
+        int len = check_rsr(flows[n].sock);
+        return len ? flow_read(n, len) : 0;
+    }
+    return 0;
+}
+
+// One datagram each time with the ioLibrary calls, the same transactions as recvfrom()
+static int rx_datagram(void)
+{
+    static int next;
+    static uint8_t buf[FLOW_BUF] __attribute__((aligned(4)));    // Payloads are word aligned for l24_read()
+    for (int i = 0; i < FLOW_MAX; i++)
+    {
+        int n = (next + i) % FLOW_MAX;
+        Flow &f = flows[n];
+        if (!f.active) continue;
+        next = n + 1;
+
+        getSn_MR(f.sock);
+        if (getSn_RX_RSR(f.sock) < 8) return 0;
+        wiz_recv_data(f.sock, buf, 8);
+        setSn_CR(f.sock, Sn_CR_RECV);
+        while (getSn_CR(f.sock));
+        int plen = (buf[6] << 8) | buf[7];
+        if (plen > FLOW_BUF - 8) plen = FLOW_BUF - 8;
+        wiz_recv_data(f.sock, buf + 8, plen);
+        setSn_CR(f.sock, Sn_CR_RECV);
+        while (getSn_CR(f.sock));
+        f.reads++;
+
+        int off = flow_parse(f, buf, 8 + plen, time_us_64());
+        f.bytes += off;
+        return off;
+    }
+    return 0;
+}
+
+
+// Run the whole capture through one strategy
+static Result replay(const char *name, int (*rx)(void), const std::vector<PcapPacket> &flow_of, const Options &o)
+{
+    Result r = { };
+    r.name = name;
+
+    mock.next_event = nullptr;
+    mock_reset(o.spi_hz / o.speed, o.txn_us * o.speed);
+    memset(flows, 0, sizeof(flows));
+    flows_memory(flow_of.size());
+    for (size_t n = 0; n < flow_of.size(); n++) flow_open(n, flow_of[n].dst, flow_of[n].dport, nullptr);
+    mixer = Mixer();
+    eq    = Eq();
+    Biquad sec[2] = { biquad_design(BQ_HIGHPASS, 40), biquad_design(BQ_PEAK, 2500, 2, -3) };
+    for (int c = 0; c < EQ_CHANNELS; c++) { eq_set(eq, c, sec, 2); eq_swap(eq); }
+
+    // Setting up the sockets is not part of the numbers
+    mock.now = mock.txns = mock.bytes = 0;
+    mock.spi_us = 0;
+    mock.next_event = next_event;
+    mock.run_event  = run_event;
+    next_packet = 0;
+    next_isr    = ISR_PERIOD_US;
+    isr_cost    = o.isr_us * o.speed;
+    events = blocks = 0;
+    clicks = dropouts = 0;
+    dsp_ns = 0;
+    memset(last, 0, sizeof(last));
+    memset(started, 0, sizeof(started));
+
+    double end = packets.empty() ? 0 : packets.back().t_us + 20000;
+    timespec a, b;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    while (mock.now < end)
+    {
+        uint64_t txns = mock.txns, bytes = mock.bytes, ev = events;
+        double   spi  = mock.spi_us, now = mock.now;
+        int got = rx();
+        if (mock.txns == txns) { mock_advance(1); continue; }       // No flows open
+
+        if (got)
+        {
+            r.read_txns  += mock.txns - txns;
+            r.read_bytes += mock.bytes - bytes;
+            r.read_us    += mock.spi_us - spi;
+            continue;
+        }
+
+        // An empty poll.  Until the next event every poll will be the same, so count them all at once.
+        uint64_t dt = mock.txns - txns, db = mock.bytes - bytes;
+        double   ds = mock.spi_us - spi, step = mock.now - now;
+        double   k  = ev == events && step > 0 ? floor((next_event() - mock.now) / step) : 0;
+        if (k > 0)
+        {
+            mock.now    += k * step;
+            mock.txns   += (uint64_t)k * dt;
+            mock.bytes  += (uint64_t)k * db;
+            mock.spi_us += k * ds;
+        }
+        r.poll_txns += (uint64_t)(k + 1) * dt;
+        r.poll_us   += (k + 1) * ds;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    mock.next_event = nullptr;
+
+    r.elapsed_us = mock.now;
+    r.wall_s     = (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) * 1e-9;
+    r.dsp_ns     = blocks ? dsp_ns / blocks : 0;
+    r.clicks     = clicks;
+    r.dropouts   = dropouts;
+    for (size_t n = 0; n < flow_of.size(); n++)
+    {
+        const MockSocket &s = mock.sock[flows[n].sock];
+        const Jitter &jb = flows[n].jb;
+        r.sent      += s.delivered + s.dropped;
+        r.dropped   += s.dropped;
+        r.parsed    += flows[n].packets;
+        r.payload   += flows[n].bytes - 8ull * flows[n].packets;
+        if (s.rsr_max > r.rsr_max) r.rsr_max = s.rsr_max;
+        r.rx_size    = s.rx_size;
+        r.late      += jb.late;
+        r.lost      += jb_lost(jb);
+        r.concealed += jb.concealed;
+        r.overflows += jb.overflows;
+    }
+    return r;
+}
+
+static void report(const Result &r, const Options &o)
+{
+    double p = r.parsed ? r.parsed : 1;
+    printf("\nSTRATEGY %-10s  SPI %.1f MHz, %.2f us per transaction, ISR %.1f us, traffic x%.2f\n",
+           r.name, o.spi_hz / 1e6, o.txn_us, o.isr_us, o.speed);
+    printf("PACKETS       sent %8u  dropped by W5500 %6u  parsed %8u  %7.2f Mbps of UDP payload\n",
+           r.sent, r.dropped, r.parsed, r.elapsed_us > 0 ? r.payload * 8.0 * o.speed / r.elapsed_us : 0.0);
+    printf("PER PACKET    %6.2f transactions  %7.1f SPI bytes  %7.2f us of SPI  (reads only)\n",
+           r.read_txns / p, r.read_bytes / p, r.read_us / o.speed / p);
+    printf("POLLING       %6.2f transactions  %7.2f us per packet   SPI busy %5.1f%% reading %5.1f%% polling\n",
+           r.poll_txns / p, r.poll_us / o.speed / p,
+           100 * r.read_us / (r.elapsed_us > 0 ? r.elapsed_us : 1), 100 * r.poll_us / (r.elapsed_us > 0 ? r.elapsed_us : 1));
+    printf("RX MEMORY     fullest %u of %u bytes\n", r.rsr_max, r.rx_size);
+    printf("AUDIO         clicks %u  dropout blocks %u  late %u  lost %u  concealed frames %u  overflows %u\n",
+           r.clicks, r.dropouts, r.late, r.lost, r.concealed, r.overflows);
+    printf("HOST          DSP %.0f ns per block, replay took %.2f s\n", r.dsp_ns, r.wall_s);
+
+    static char text[4096];
+    flows_text(text, (uint64_t)r.elapsed_us);
+    fputs(text, stdout);
+}
+
+
+// The first RTP looking flows in the capture, or the ones asked for
+static bool choose_flows(std::vector<PcapPacket> &chosen, const std::vector<const char *> &asked)
+{
+    for (const char *a : asked)
+    {
+        unsigned g[4], port;
+        if (sscanf(a, "%u.%u.%u.%u:%u", &g[0], &g[1], &g[2], &g[3], &port) != 5) { fprintf(stderr, "bad flow %s\n", a); return false; }
+        PcapPacket k = { };
+        for (int i = 0; i < 4; i++) k.dst[i] = g[i];
+        k.dport = port;
+        chosen.push_back(k);
+    }
+    for (const PcapPacket &k : packets)
+    {
+        if (!asked.empty() || chosen.size() == FLOW_MAX) break;
+        int plen = (int)k.data.size() - 12;
+        if (plen <= 0 || (k.data[0] & 0xC0) != 0x80 || plen % (3 * JB_FRAMES)) continue;
+        bool known = false;
+        for (const PcapPacket &c : chosen) known |= !memcmp(c.dst, k.dst, 4) && c.dport == k.dport;
+        if (!known) chosen.push_back(k);
+    }
+    if (chosen.empty()) { fprintf(stderr, "no L24 RTP flows of %d frames in the capture\n", JB_FRAMES); return false; }
+    for (const PcapPacket &c : chosen)
+        printf("FLOW          %d.%d.%d.%d:%d\n", c.dst[0], c.dst[1], c.dst[2], c.dst[3], c.dport);
+    return true;
+}
+
+// Largest sample to sample step in each channel of the audio sent, for the click threshold
+static void source_steps(const std::vector<PcapPacket> &chosen, double k)
+{
+    int32_t step[JB_CHANNELS] = { };
+    for (const PcapPacket &c : chosen)
+    {
+        int32_t flow_step[JB_CHANNELS] = { }, prev[JB_CHANNELS] = { };
+        int last_seq = -1;
+        for (const PcapPacket &p : packets)
+        {
+            if (memcmp(p.dst, c.dst, 4) || p.dport != c.dport || p.data.size() < 12) continue;
+            int plen = p.data.size() - 12, nch = plen / (3 * JB_FRAMES);
+            if (nch == 0 || nch * 3 * JB_FRAMES != plen) continue;
+            int seq = (p.data[2] << 8) | p.data[3];
+            bool joined = seq == ((last_seq + 1) & 0xFFFF);
+            for (int f = 0; f < JB_FRAMES; f++)
+                for (int ch = 0; ch < nch && ch < JB_CHANNELS; ch++)
+                {
+                    const uint8_t *s = &p.data[12 + 3 * (f * nch + ch)];
+                    int32_t v = (int32_t)((s[0] << 24) | (s[1] << 16) | (s[2] << 8)) >> 8;
+                    int32_t d = abs(v - prev[ch]);
+                    if ((f || joined) && d > flow_step[ch]) flow_step[ch] = d;
+                    prev[ch] = v;
+                }
+            last_seq = seq;
+        }
+        for (int ch = 0; ch < JB_CHANNELS; ch++) step[ch] += flow_step[ch];
+    }
+    for (int ch = 0; ch < JB_CHANNELS; ch++) threshold[ch] = (int32_t)(k * step[ch]) + 64;
+}
+
+
+// A capture of sine waves, the same every time
+static int make(int argc, char **argv)
+{
+    const char *file = argv[0];
+    double seconds = argc > 1 ? atof(argv[1]) : 10;
+    int    nflows  = argc > 2 ? atoi(argv[2]) : 1;
+    int    nch     = argc > 3 ? atoi(argv[3]) : 8;
+    double jitter  = argc > 4 ? atof(argv[4]) : 300;
+    double loss    = argc > 5 ? atof(argv[5]) : 0.1;
+    if (nflows < 1 || nflows > FLOW_MAX || nch < 1 || nch > 8) { fprintf(stderr, "1 to %d flows of 1 to 8 channels\n", FLOW_MAX); return 1; }
+
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    auto uniform = [&rng]() { rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17; return ((rng >> 11) + 0.5) / 9007199254740992.0; };
+
+    std::vector<PcapPacket> out;
+    int n = (int)(seconds * 1000);
+    for (int fl = 0; fl < nflows; fl++)
+        for (int i = 0; i < n; i++)
+        {
+            if (uniform() * 100 < loss) continue;
+            PcapPacket k;
+            uint8_t src[4] = { 10, 0, 0, (uint8_t)(10 + fl) }, dst[4] = { 239, 69, 0, (uint8_t)(1 + fl) };
+            memcpy(k.src, src, 4);
+            memcpy(k.dst, dst, 4);
+            k.sport = k.dport = 5004;
+            double mean = uniform() < 0.1 ? 3 * jitter : jitter;
+            k.t_us = 1000.0 * i * (1 - 50e-6) + 37.0 * fl - mean * log(uniform());
+
+            uint32_t ts = 48 * i;
+            uint8_t h[12] = { 0x80, 97, (uint8_t)(i >> 8), (uint8_t)i, (uint8_t)(ts >> 24), (uint8_t)(ts >> 16), (uint8_t)(ts >> 8), (uint8_t)ts,
+                              0x12, 0x34, 0x56, (uint8_t)fl };
+            k.data.assign(h, h + 12);
+            for (int f = 0; f < JB_FRAMES; f++)
+                for (int c = 0; c < nch; c++)
+                {
+                    double hz = 200.0 * (c + 1) + 50.0 * fl;
+                    int32_t v = (int32_t)lrint(0x3FFFFF * sin(2 * M_PI * hz * (ts + f) / 48000));
+                    k.data.push_back(v >> 16); k.data.push_back(v >> 8); k.data.push_back(v);
+                }
+            out.push_back(std::move(k));
+        }
+    std::stable_sort(out.begin(), out.end(), [](const PcapPacket &a, const PcapPacket &b) { return a.t_us < b.t_us; });
+    double t0 = out.empty() ? 0 : out[0].t_us;
+    for (PcapPacket &k : out) k.t_us -= t0;
+    if (!pcap_write(file, out)) return 1;
+    printf("%s  %zu packets, %d flows of %d channels, %.0f us jitter, %.2f%% loss\n", file, out.size(), nflows, nch, jitter, loss);
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    Options o;
+    const char *strategy = "all", *file = nullptr;
+    std::vector<const char *> asked;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *a = argv[i];
+        bool more = i + 1 < argc;
+        if      (!strcmp(a, "--make") && more)  return make(argc - i - 1, argv + i + 1);
+        else if (!strcmp(a, "-s") && more)      strategy = argv[++i];
+        else if (!strcmp(a, "-f") && more)      asked.push_back(argv[++i]);
+        else if (!strcmp(a, "-x") && more)      o.speed  = atof(argv[++i]);
+        else if (!strcmp(a, "-k") && more)      o.click  = atof(argv[++i]);
+        else if (!strcmp(a, "--spi") && more)   o.spi_hz = atof(argv[++i]);
+        else if (!strcmp(a, "--txn") && more)   o.txn_us = atof(argv[++i]);
+        else if (!strcmp(a, "--isr") && more)   o.isr_us = atof(argv[++i]);
+        else if (a[0] != '-' && !file)          file = a;
+        else                                    file = nullptr, i = argc;
+    }
+    if (!file || o.speed <= 0 || asked.size() > FLOW_MAX)
+    {
+        fprintf(stderr, "usage: %s [-s fullest|roundrobin|datagram|all] [-f group:port]... [-x factor] [--spi hz] [--txn us] [--isr us] [-k factor] capture.pcap\n"
+                        "       %s --make out.pcap [seconds] [flows] [channels] [jitter_us] [loss_pct]\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    int skipped = 0;
+    if (!pcap_read(file, packets, skipped)) return 1;
+    std::stable_sort(packets.begin(), packets.end(), [](const PcapPacket &a, const PcapPacket &b) { return a.t_us < b.t_us; });
+    for (PcapPacket &k : packets) k.t_us += 1000;
+    printf("CAPTURE       %s  %zu UDP packets over %.2f s, %d other packets skipped\n",
+           file, packets.size(), packets.empty() ? 0.0 : (packets.back().t_us - 1000) / 1e6, skipped);
+
+    std::vector<PcapPacket> chosen;
+    if (!choose_flows(chosen, asked)) return 1;
+    source_steps(chosen, o.click);
+
+    struct { const char *name; int (*rx)(void); } strategies[] = { { "fullest", flow_service }, { "roundrobin", rx_roundrobin }, { "datagram", rx_datagram } };
+    std::vector<Result> results;
+    for (auto &s : strategies)
+    {
+        if (strcmp(strategy, "all") && strcmp(strategy, s.name)) continue;
+        results.push_back(replay(s.name, s.rx, chosen, o));
+        report(results.back(), o);
+    }
+    if (results.empty()) { fprintf(stderr, "no strategy %s\n", strategy); return 1; }
+
+    if (results.size() > 1)
+    {
+        printf("\nSTRATEGY      dropped  txn/pkt  bytes/pkt  us/pkt  poll us/pkt  rx fullest  clicks  dropouts  concealed\n");
+        for (const Result &r : results)
+        {
+            double p = r.parsed ? r.parsed : 1;
+            printf("%-12s  %7u  %7.2f  %9.1f  %6.2f  %11.2f  %10u  %6u  %8u  %9u\n", r.name, r.dropped, r.read_txns / p,
+                   r.read_bytes / p, r.read_us / o.speed / p, r.poll_us / o.speed / p, r.rsr_max, r.clicks, r.dropouts, r.concealed);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,129 @@
+//////////////////////////////////////////////////////////////////////
+// The whole firmware pipeline as a Linux process
+//
+// This is main() of i2s_example.cpp built against the Linux backend of hal.h
+// (tools/host/hal_linux.h).  The same dante_test() finds the devices by mDNS
+// and port 4440, the same flows.h, jitter.h and udp_test() receive them, and
+// the same dma_handler from audio_path.h runs the deinterleave, RTP transmit,
+// flows, mixer, EQ, filter2x and meters, off a fake DMA clock instead of the
+// PIO.  The W5500 is the model in mock_w5500.cpp, bridged to UDP sockets on
+// loopback, and the capture and the outputs are WAV files.  Core 1 and the
+// status page are not run.
+//
+// With nothing else on loopback, a stand in device (dante_device.h) answers
+// the discovery and sends an 8 channel flow, which with NET_RX set here is
+// what comes out.  The input WAV goes out as the RTP transmit, which
+// telemetry_collect or tcpdump -i lo can watch.
+//
+// By default the clock runs as fast as the host can go, which with perf is
+// the way to see where the time goes:
+//
+//   pipeline_host --seconds 60 --out out.wav
+//   perf record -g ./pipeline_host --seconds 60 && perf report
+//
+// --realtime holds it to 48kHz against the wall clock, for talking to other
+// processes or devices on loopback.  The times reported are the host's, and
+// the deadline figures are against the host keeping up, which says nothing
+// about the RP2040, only where the time is going.  Blocks that start late in
+// real time are the host's scheduling, a sleep on a busy or virtual machine
+// can be out by more than a block.
+//
+//   pipeline_host [options]
+//     --in file.wav        capture, 48kHz, up to 8 channels, silence without
+//     --out file.wav       the four output lines as 8 channels at 96kHz, 32 bit
+//     --seconds s          simulated time to run, default 10, 0 for ever
+//     --realtime           keep to the wall clock
+//     --no-device          no stand in device, find others on loopback
+//     --channels n         channels of the stand in device's flow, default 8
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hal.h"
+#include "mock_w5500.h"
+#include "dante_device.h"
+
+#define ADC_DECIMATE 1
+#define ISR_BLOCK    4                                              // As i2s_example.cpp
+#define MIX_MODE     MIX_IDENTITY
+#define NET_RX       1                                              // The flows are what comes out
+#define FLOW_DEVICES { "HOST-Dante" }
+#define LATENCY      LAT_OFF
+#define LATENCY_PATH LAT_OUTPUT, 0, LAT_INPUT, 0
+
+#include "audio_path.h"
+#include "udp_test.h"
+#include "dante_snoop.h"
+
+static const uint8_t device_ip[4]    = { 127, 0, 0, 50 };           // 10.0.0.50 to the board
+static const uint8_t device_group[4] = { 239, 255, 0, 50 };
+
+
+static void report(void)
+{
+    static char str[8000];
+    HalLinuxStats s = hal_linux_stats();
+    double sim = mock.now * 1e-6, wall = s.wall_us * 1e-6, block = ISR_BLOCK * 1e6 / 48000;
+    printf("\n\nSIMULATED     %10.3f s   wall %10.3f s   %6.2f x real time\n", sim, wall, wall > 0 ? sim / wall : 0);
+    printf("ISR           blocks %10llu  mean %8.3f us  max %8.3f us  of %6.2f us   late %llu  unacked %llu\n",
+           (unsigned long long)s.blocks, s.blocks ? s.isr_us / s.blocks : 0, s.isr_max_us, block, (unsigned long long)s.late_blocks,
+           (unsigned long long)s.unacked);
+    printf("UDP           in %8lu  out %8lu\n", (unsigned long)s.udp_in, (unsigned long)s.udp_out);
+    uint32_t packets, queries;
+    dante_device_counts(packets, queries);
+    if (packets) printf("DEVICE        sent %8lu  queries %4lu\n", (unsigned long)packets, (unsigned long)queries);
+    printf("RTP TX        sent %8lu  overruns %6lu  timeouts %6lu\n",
+           (unsigned long)rtp_tx.sent, (unsigned long)rtp_tx.overruns, (unsigned long)rtp_tx.timeouts);
+    flows_text(str, mock.now);
+    printf("%s\n", str);
+    deadline_text(deadline, str, sizeof(str));
+    printf("%s\n", str);
+    MeterSnapshot levels;
+    meter_read(meter, levels);
+    meter_text(levels, str, sizeof(str));
+    printf("%s\n", str);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    const char *in = nullptr, *out = nullptr;
+    double seconds = 10;
+    bool realtime = false, device = true;
+    int channels = 8;
+    for (int i = 1; i < argc; i++)
+    {
+        const char *a = argv[i];
+        bool more = i + 1 < argc;
+        if      (!strcmp(a, "--in") && more)        in       = argv[++i];
+        else if (!strcmp(a, "--out") && more)       out      = argv[++i];
+        else if (!strcmp(a, "--seconds") && more)   seconds  = atof(argv[++i]);
+        else if (!strcmp(a, "--channels") && more)  channels = atoi(argv[++i]);
+        else if (!strcmp(a, "--realtime"))          realtime = true;
+        else if (!strcmp(a, "--no-device"))         device   = false;
+        else
+        {
+            fprintf(stderr, "usage: %s [--in file.wav] [--out file.wav] [--seconds s] [--realtime] [--no-device] [--channels n]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (channels < 1 || channels > JB_CHANNELS) { fprintf(stderr, "1 to %d channels\n", JB_CHANNELS); return 1; }
+
+    hal_linux_start(realtime, seconds, report);
+    if (in  && !hal_linux_wav_in(in))   return 1;
+    if (out && !hal_linux_wav_out(out)) return 1;
+    if (device)
+    {
+        if (!dante_device_open("HOST-Dante", device_ip, device_group, 5004, channels)) return 1;
+        hal_linux_every(DANTE_DEVICE_PACKET_US, dante_device_service);
+    }
+
+    // From here as main() in i2s_example.cpp, less the PIO and core 1
+    if (!pipeline_start()) printf("NO FLOWS\n");
+    deadline_init(deadline, pio0, 0, 0, pio1, 0b1111, 2, audio_out[0][0][0], 4*ISR_BLOCK);
+    hal_linux_audio(dma_handler, audio_int[0][0][0], audio_out[0][0][0], ISR_BLOCK);
+    udp_test();                                                     // Until hal_linux_start() stops it
+    return 0;
+}
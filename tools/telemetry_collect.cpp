@@ -0,0 +1,335 @@
+//////////////////////////////////////////////////////////////////////
+// Collector for the binary telemetry from telemetry.h
+//
+// Listens on a UDP port, joins the multicast group if it is one, and writes
+// every record of every datagram as a CSV row
+//
+//   host_time,board,seq,time_us,type,name,index,value
+//
+//   counter   name is the counter, index its id, value the absolute count
+//   hist      name is the histogram, index the lowest value in the bin and
+//             value the number added to the bin since the last datagram
+//   trace     name is the event, index the stage, time_us when it happened
+//
+// host_time is seconds since the epoch when the datagram arrived, so rows
+// from many boards can go straight into a time series database, or be
+// grouped by board and summed for fleet wide histograms.  Gaps in the
+// sequence numbers of each board are reported on stderr, with a summary of
+// each board on exit.
+//
+// There is no board needed to try it.  --emit sends made up datagrams, built
+// with the same writer as the firmware, to any address, and --selftest sends
+// some over the loopback to itself and checks they decode to what was sent.
+//
+//   telemetry_collect [-g group] [-p port] [-o file.csv]
+//   telemetry_collect --emit host[:port] [count]
+//   telemetry_collect --selftest
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <map>
+#include "telemetry_proto.h"
+
+#define DEFAULT_GROUP   "239.69.0.100"
+#define DEFAULT_PORT    5005
+
+struct Board
+{
+    uint32_t    last_seq;
+    uint32_t    received;
+    uint32_t    lost;
+    uint32_t    bad;
+};
+
+static std::map<uint32_t, Board> boards;
+static volatile bool             running = true;
+
+
+static double host_time(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static const char *counter_name(int id, char *tmp)
+{
+    if (id < TLM_COUNTERS_N) return tlm_counter_name[id];
+    int flow = (id >> 8) - 1, c = id & 0xFF;
+    if (flow >= 0 && c < TLM_FLOW_N) sprintf(tmp, "flow%d.%s", flow, tlm_flow_name[c]);
+    else                             sprintf(tmp, "counter%d", id);
+    return tmp;
+}
+
+// Decode one datagram into CSV rows, returns the rows written or -1 if it is not telemetry
+static int decode(const uint8_t *p, int len, double now, FILE *out)
+{
+    if (len < TLM_HEADER || tlm_get32(p) != TLM_MAGIC || p[4] != TLM_VERSION) return -1;
+    int size = tlm_get16(p + 6);
+    if (size < TLM_HEADER || size > len) return -1;
+
+    uint32_t board = tlm_get32(p + 8);
+    uint32_t seq   = tlm_get32(p + 12);
+    uint64_t time  = tlm_get64(p + 16);
+
+    auto found = boards.find(board);
+    Board &b = boards[board];
+    if (found == boards.end())
+        fprintf(stderr, "board %08x  first datagram seq %u\n", board, seq);
+    else if (seq != b.last_seq + 1)
+    {
+        uint32_t gap = seq - b.last_seq - 1;
+        if (gap < 0x80000000u)
+        {
+            b.lost += gap;
+            fprintf(stderr, "board %08x  lost %u datagrams before seq %u\n", board, gap, seq);
+        }
+        else fprintf(stderr, "board %08x  seq went back from %u to %u, restarted?\n", board, b.last_seq, seq);
+    }
+    b.last_seq = seq;
+    b.received++;
+
+    int rows = 0;
+    char tmp[32];
+    for (int at = TLM_HEADER; at < size; )
+    {
+        if (at + 4 > size) { b.bad++; return rows; }
+        int type = p[at], id = p[at + 1], body = tlm_get16(p + at + 2);
+        const uint8_t *r = p + at + 4, *end = r + body;
+        if (at + 4 + body > size) { b.bad++; return rows; }
+        at += 4 + body;
+
+        switch (type)
+        {
+            case TLM_COUNTERS:
+                for (; r + 6 <= end; r += 6, rows++)
+                    fprintf(out, "%.6f,%08x,%u,%llu,counter,%s,%u,%u\n", now, board, seq, (unsigned long long)time,
+                            counter_name(tlm_get16(r), tmp), tlm_get16(r), tlm_get32(r + 2));
+                break;
+            case TLM_HIST:
+                for (; r + 5 <= end; r += 5, rows++)
+                    fprintf(out, "%.6f,%08x,%u,%llu,hist,%s,%u,%u\n", now, board, seq, (unsigned long long)time,
+                            id < TLM_HISTS ? tlm_hist_name[id] : "unknown", tlm_bin_low(r[0]), tlm_get32(r + 1));
+                break;
+            case TLM_TRACE:
+                for (; r + 8 <= end; r += 8, rows++)
+                {
+                    uint64_t t = (time & ~0xFFFFFFFFull) | tlm_get32(r);       // Events carry the low 32 bits
+                    if (t > time && t >= 0x100000000ull) t -= 0x100000000ull;
+                    fprintf(out, "%.6f,%08x,%u,%llu,trace,%s,%u,%u\n", now, board, seq, (unsigned long long)t,
+                            tlm_trace_name[r[4] & 3], r[5], tlm_get16(r + 6));
+                }
+                break;
+            default:                                                // Newer record types are skipped
+                break;
+        }
+    }
+    return rows;
+}
+
+static void summary(void)
+{
+    for (auto &i : boards)
+        fprintf(stderr, "board %08x  received %u  lost %u  bad %u  last seq %u\n",
+                i.first, i.second.received, i.second.lost, i.second.bad, i.second.last_seq);
+}
+
+static int open_listen(const char *group, int port)
+{
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s < 0) { perror("socket"); return -1; }
+    int one = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    int big = 1 << 20;
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, &big, sizeof(big));
+
+    struct sockaddr_in addr = { };
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) { perror("bind"); close(s); return -1; }
+
+    struct in_addr g;
+    if (group && inet_aton(group, &g) && IN_MULTICAST(ntohl(g.s_addr)))
+    {
+        struct ip_mreq mreq = { };
+        mreq.imr_multiaddr        = g;
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) perror("IP_ADD_MEMBERSHIP");
+    }
+    return s;
+}
+
+
+// A made up datagram, the same shape as telemetry_build() makes
+static int synthetic(uint8_t *buf, uint32_t board, uint32_t seq, uint64_t time_us)
+{
+    TlmWriter w;
+    tlm_begin(w, buf, TLM_MAX, board, seq, time_us);
+    tlm_record(w, TLM_COUNTERS, 0);
+    tlm_counter(w, TLM_C_DL_BLOCKS, seq * 1200);
+    tlm_counter(w, TLM_C_ISR_WORST, 9 + seq % 3);
+    tlm_counter(w, TLM_FLOW(0, TLM_F_PACKETS), seq * 100);
+    tlm_record_end(w);
+
+    static uint32_t live[TLM_BINS], last[TLM_BINS];
+    live[tlm_bin(7)]  += 1000;
+    live[tlm_bin(12)] += 190 + seq % 10;
+    tlm_hist(w, TLM_H_ISR_US, live, last);
+
+    if (seq % 5 == 4)
+    {
+        tlm_record(w, TLM_TRACE, 0);
+        tlm_trace(w, (uint32_t)time_us - 500, 0, 2, 250);
+        tlm_record_end(w);
+    }
+    int len = tlm_finish(w);
+    tlm_hist_sent(buf, len, TLM_H_ISR_US, last);
+    return len;
+}
+
+static bool parse_dest(const char *arg, struct sockaddr_in &addr)
+{
+    char host[64];
+    snprintf(host, sizeof(host), "%s", arg);
+    int port = DEFAULT_PORT;
+    char *colon = strchr(host, ':');
+    if (colon) { *colon = 0; port = atoi(colon + 1); }
+    addr = { };
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(port);
+    return inet_aton(host, &addr.sin_addr);
+}
+
+static int emit(const char *dest, int count)
+{
+    struct sockaddr_in addr;
+    if (!parse_dest(dest, addr)) { fprintf(stderr, "bad address %s\n", dest); return 1; }
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    unsigned char ttl = 1;
+    setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+
+    uint8_t buf[TLM_MAX];
+    for (int n = 0; n < count && running; n++)
+    {
+        int len = synthetic(buf, 0xE3A1C0DE, n, 100000ull * n);
+        sendto(s, buf, len, 0, (struct sockaddr *)&addr, sizeof(addr));
+        usleep(1000000 / 10);
+    }
+    close(s);
+    return 0;
+}
+
+
+// Send datagrams over the loopback, drop one, and check what comes back
+static int selftest(void)
+{
+    int rx = open_listen(NULL, 0);
+    if (rx < 0) return 1;
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof(addr);
+    getsockname(rx, (struct sockaddr *)&addr, &alen);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+
+    const int N = 10, DROP = 6;                                     // The fifth crosses 2^32 us, so its event is from before the wrap
+    uint8_t buf[TLM_MAX];
+    int sent_rows = 0;
+    for (int n = 0; n < N; n++)
+    {
+        int len = synthetic(buf, 0x00C0FFEE, n, 1000000ull * n + 4290967496ull);
+        sent_rows += 3 + 2 + (n % 5 == 4);
+        if (n == DROP) { sent_rows -= 3 + 2 + (n % 5 == 4); continue; }
+        sendto(tx, buf, len, 0, (struct sockaddr *)&addr, sizeof(addr));
+    }
+    uint8_t junk[40] = { 'n', 'o', 't', ' ', 't', 'l', 'm' };
+    sendto(tx, junk, sizeof(junk), 0, (struct sockaddr *)&addr, sizeof(addr));
+
+    char *text = NULL;
+    size_t text_len = 0;
+    FILE *out = open_memstream(&text, &text_len);
+    struct timeval tv = { 1, 0 };
+    setsockopt(rx, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int rows = 0, datagrams = 0, rejected = 0;
+    for (int n = 0; n < N; n++)
+    {
+        int len = recv(rx, buf, sizeof(buf), 0);
+        if (len < 0) break;
+        int r = decode(buf, len, host_time(), out);
+        if (r < 0) rejected++;
+        else       { rows += r; datagrams++; }
+    }
+    fclose(out);
+    close(rx);
+    close(tx);
+
+    Board &b = boards[0x00C0FFEE];
+    bool ok = datagrams == N - 1 && rejected == 1 && rows == sent_rows && b.lost == 1 && b.bad == 0
+           && strstr(text, ",00c0ffee,9,4299967496,counter,dl_blocks,2,10800\n")
+           && strstr(text, ",00c0ffee,3,4293967496,counter,flow0.packets,256,300\n")
+           && strstr(text, ",00c0ffee,0,4290967496,hist,isr_us,6,1000\n")
+           && strstr(text, ",00c0ffee,4,4294966996,trace,miss,2,250\n");
+    printf("%s  datagrams %d  rejected %d  rows %d of %d  lost %u\n", ok ? "PASS" : "FAIL", datagrams, rejected, rows, sent_rows, b.lost);
+    if (!ok) fputs(text, stdout);
+    free(text);
+    return ok ? 0 : 1;
+}
+
+
+static void stop(int) { running = false; }
+
+int main(int argc, char **argv)
+{
+    const char *group = DEFAULT_GROUP;
+    const char *file  = NULL;
+    int         port  = DEFAULT_PORT;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if      (!strcmp(argv[i], "--selftest"))            return selftest();
+        else if (!strcmp(argv[i], "--emit") && i + 1 < argc) return emit(argv[i + 1], i + 2 < argc ? atoi(argv[i + 2]) : 1000000);
+        else if (!strcmp(argv[i], "-g") && i + 1 < argc)     group = argv[++i];
+        else if (!strcmp(argv[i], "-p") && i + 1 < argc)     port  = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)     file  = argv[++i];
+        else
+        {
+            fprintf(stderr, "usage: %s [-g group] [-p port] [-o file.csv]\n"
+                            "       %s --emit host[:port] [count]\n"
+                            "       %s --selftest\n", argv[0], argv[0], argv[0]);
+            return 1;
+        }
+    }
+
+    FILE *out = file ? fopen(file, "w") : stdout;
+    if (!out) { perror(file); return 1; }
+    int s = open_listen(group, port);
+    if (s < 0) return 1;
+
+    struct sigaction sa = { };
+    sa.sa_handler = stop;                                           // No SA_RESTART, so recv() returns
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    fprintf(out, "host_time,board,seq,time_us,type,name,index,value\n");
+    uint8_t buf[2048];
+    while (running)
+    {
+        int len = recv(s, buf, sizeof(buf), 0);
+        if (len < 0) continue;
+        if (decode(buf, len, host_time(), out) < 0) fprintf(stderr, "ignored a %d byte datagram that is not telemetry\n", len);
+        fflush(out);
+    }
+    summary();
+    if (file) fclose(out);
+    close(s);
+    return 0;
+}
@@ -0,0 +1,151 @@
+//////////////////////////////////////////////////////////////////////
+// Reading and writing PCM WAV files, a frame of int32 at a time
+//
+// Only what the host pipeline needs.  16, 24 and 32 bit integer PCM, plain
+// or WAVE_FORMAT_EXTENSIBLE, any number of channels.  Samples are handed
+// over left justified in int32, as audio_tdm and audio_out hold them.  The
+// writer puts in the sizes when it is closed.
+//
+
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+struct WavFile
+{
+    FILE       *f;
+    int         channels, rate, bits;
+    uint32_t    frames;                                             // In the file when reading, written so far when writing
+    uint32_t    pos;
+    bool        writing;
+};
+
+static inline uint32_t wav_get32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static inline uint16_t wav_get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+// Leaves the file at the start of the data
+static bool wav_open_read(const char *file, WavFile &w)
+{
+    memset(&w, 0, sizeof(w));
+    w.f = fopen(file, "rb");
+    if (!w.f) { perror(file); return false; }
+
+    uint8_t h[12];
+    if (fread(h, 1, 12, w.f) != 12 || memcmp(h, "RIFF", 4) || memcmp(h + 8, "WAVE", 4))
+    {
+        fprintf(stderr, "%s: not a WAV file\n", file);
+        fclose(w.f);
+        return false;
+    }
+    int format = 0;
+    while (fread(h, 1, 8, w.f) == 8)
+    {
+        uint32_t size = wav_get32(h + 4);
+        if (!memcmp(h, "fmt ", 4))
+        {
+            uint8_t fmt[40] = { };
+            if (size < 16 || fread(fmt, 1, size < 40 ? size : 40, w.f) < 16) break;
+            if (size > 40) fseek(w.f, size - 40, SEEK_CUR);
+            format     = wav_get16(fmt);
+            w.channels = wav_get16(fmt + 2);
+            w.rate     = wav_get32(fmt + 4);
+            w.bits     = wav_get16(fmt + 14);
+            if (format == 0xFFFE && size >= 26) format = wav_get16(fmt + 24);      // The sub format of EXTENSIBLE
+        }
+        else if (!memcmp(h, "data", 4))
+        {
+            if (format != 1 || (w.bits != 16 && w.bits != 24 && w.bits != 32) || w.channels < 1)
+            {
+                fprintf(stderr, "%s: only 16, 24 or 32 bit integer PCM is read\n", file);
+                break;
+            }
+            w.frames = size / (w.channels * w.bits / 8);
+            return true;
+        }
+        else fseek(w.f, size + (size & 1), SEEK_CUR);
+    }
+    fprintf(stderr, "%s: no PCM data\n", file);
+    fclose(w.f);
+    return false;
+}
+
+// Up to n frames into out, channels words each, returns the frames read
+static int wav_read(WavFile &w, int32_t *out, int n)
+{
+    uint8_t buf[4096];
+    int bytes = w.bits / 8, frame = bytes * w.channels, done = 0;
+    if (n > (int)(w.frames - w.pos)) n = w.frames - w.pos;
+    while (done < n)
+    {
+        int k = n - done;
+        if (k > (int)sizeof(buf) / frame) k = sizeof(buf) / frame;
+        if (k == 0 || fread(buf, frame, k, w.f) != (size_t)k) break;
+        const uint8_t *p = buf;
+        for (int i = 0; i < k * w.channels; i++, p += bytes)
+        {
+            uint32_t v = 0;
+            for (int b = 0; b < bytes; b++) v |= (uint32_t)p[b] << (32 - 8 * bytes + 8 * b);
+            *out++ = (int32_t)v;
+        }
+        done += k;
+    }
+    w.pos += done;
+    return done;
+}
+
+static bool wav_open_write(const char *file, WavFile &w, int channels, int rate, int bits)
+{
+    memset(&w, 0, sizeof(w));
+    w.f = fopen(file, "wb");
+    if (!w.f) { perror(file); return false; }
+    w.channels = channels;
+    w.rate     = rate;
+    w.bits     = bits;
+    w.writing  = true;
+    uint8_t h[44] = { };
+    fwrite(h, 1, sizeof(h), w.f);                                   // Filled in by wav_close()
+    return true;
+}
+
+// n frames from in, channels words each
+static void wav_write(WavFile &w, const int32_t *in, int n)
+{
+    uint8_t buf[4096];
+    int bytes = w.bits / 8, frame = bytes * w.channels;
+    while (n > 0)
+    {
+        int k = n < (int)sizeof(buf) / frame ? n : sizeof(buf) / frame;
+        uint8_t *p = buf;
+        for (int i = 0; i < k * w.channels; i++)
+        {
+            uint32_t v = (uint32_t)*in++;
+            for (int b = 0; b < bytes; b++) *p++ = v >> (32 - 8 * bytes + 8 * b);
+        }
+        fwrite(buf, frame, k, w.f);
+        w.frames += k;
+        n -= k;
+    }
+}
+
+static void wav_close(WavFile &w)
+{
+    if (!w.f) return;
+    if (w.writing)
+    {
+        uint32_t data = w.frames * w.channels * (w.bits / 8);
+        uint8_t h[44];
+        auto put32 = [&h](int at, uint32_t v) { for (int b = 0; b < 4; b++) h[at + b] = v >> (8 * b); };
+        auto put16 = [&h](int at, uint16_t v) { h[at] = v; h[at + 1] = v >> 8; };
+        memcpy(h, "RIFF", 4);      put32(4, 36 + data);
+        memcpy(h + 8, "WAVEfmt ", 8);
+        put32(16, 16);             put16(20, 1);               put16(22, w.channels);
+        put32(24, w.rate);         put32(28, w.rate * w.channels * (w.bits / 8));
+        put16(32, w.channels * (w.bits / 8));                  put16(34, w.bits);
+        memcpy(h + 36, "data", 4); put32(40, data);
+        fseek(w.f, 0, SEEK_SET);
+        fwrite(h, 1, sizeof(h), w.f);
+    }
+    fclose(w.f);
+    w.f = nullptr;
+}
@@ -140,95 +140,71 @@
 //   0.0                                            1000                                              2000
 
 
-#include "histogram.hpp"
-
-extern "C" {
-#include "port_common.h"
-#include "wizchip_conf.h"
-#include "w5x00_spi.h"
-#include "socket.h"
-}
-
-
-using namespace DAES67;
+// The single socket receive has since moved to flows.h, which takes the same
+// burst read over up to four sockets.  udp_test() is now the network loop
+// that runs the flows, the transmit and the telemetry, and keeps the
+// histograms above.
 
-#define SOCK 5
 
-int check_rsr()
-{
-
-    uint8_t req[3] = {0x00, 0x26, ((4*SOCK+1)<<3) + 0};      // Read two bytes from RSR register
-    uint16_t val = 0;
-
-//    WIZCHIP_CRITICAL_ENTER();
-    WIZCHIP.CS._select();
-    spi_write_blocking(SPI_PORT, req,   3);
-    spi_read_blocking(SPI_PORT, 0x00, (uint8_t *)&val,2);
-    WIZCHIP.CS._deselect();
-//    WIZCHIP_CRITICAL_EXIT();
+#include "histogram.hpp"
+#include "rtp_tx.h"
+#include "flows.h"
+#include "telemetry.h"
+#include "latency.h"
 
-    return ((val&0xFF)<<8) | (val>>8);
-}
 
+using namespace DAES67;
 
+extern Latency latency;
 
 
-void udp_test(uint8_t ip[4], int port)
+// Open the flows with flow_open() first, if any, this never returns.  With none it is still where
+// the latency search is worked through.
+void udp_test(void)
 {
-    printf("LISTENING TO  %d.%d.%d.%d:%d\n",ip[0],ip[1],ip[2],ip[3],port);
-    int sock=0;
-    if (0)
-    {
-        sock = socket(SOCK, Sn_MR_UDP, 5000, SF_IO_NONBLOCK);
-    }
-    else
-    {
-        uint8_t multicast_mac[6] = {0x01, 0x00, 0x5E, ip[1], ip[2], ip[3]};
-        setSn_MR(SOCK, Sn_MR_UDP);
-        setSn_DHAR(SOCK, multicast_mac);	
-    	setSn_DIPR(SOCK, ip);
-    	setSn_DPORT(SOCK, port);
-        sock = socket(SOCK, Sn_MR_UDP, port, SF_IO_NONBLOCK | Sn_MR_MULTI);
-    }
-
-    printf("SOCKET OPEN     %d\n",sock);
-    printf("SOCKET STATUS   %d\n\n\n",getSn_SR(5));
-
-    Histogram  Times("Packet Times",0,.001);
-    Histogram  Sizes("Packet Size",0,1000);
-    char buf[2048];
-    char    str[8000];
+    static Histogram  Times("Packet Times",0,.001);                 // Static, as none of these fit the 2k core 0 stack
+    static Histogram  Sizes("Packet Size",0,1000);
+    static Histogram  Lat("Latency",0,.02);
+    static char str[8000];
     int64_t last = Times.now();
+    uint64_t last_us = time_us_64();
+    uint64_t last_read = last_us;
     while(1)
     {
-        uint8_t addr[4];
-        uint16_t port;
-        int len = check_rsr();
-        if (len>100)
+        int len = flow_service();
+        if (len)
         {
-            uint16_t ptr = getSn_RX_RD(SOCK);
-            uint32_t addrsel = ((uint32_t)ptr << 8) + (WIZCHIP_RXBUF_BLOCK(SOCK) << 3);
-            uint8_t req[3] = { addrsel>>16, addrsel>>8, addrsel};
-
-            WIZCHIP.CS._select();
-            spi_write_blocking(SPI_PORT, req,   3);
-//          spi_read_blocking(SPI_PORT, 0x00, (uint8_t *)buf,16*2*3);       // Simulate getting 2ch of data
-            spi_read_blocking(SPI_PORT, 0x00, (uint8_t *)buf,len);       // Get all data
-            WIZCHIP.CS._deselect();
-            ptr += len;
-            setSn_RX_RD(SOCK,ptr);
-            setSn_CR(SOCK,Sn_CR_RECV);
             Times.time();
             Sizes.add(len);
+            uint64_t now = time_us_64();
+            tlm_add(TLM_H_READ_GAP_US, (uint32_t)(now - last_read));
+            tlm_add(TLM_H_READ_BYTES, len);
+            last_read = now;
         }
+        rtp_tx_service();                                           // Transmit runs alongside the receive
+        telemetry_service();
+        latency_service(latency, &Lat, flow_depth(latency.det_ch)); // Searches a capture a few lags at a time
         if (Times.now() - last > 20000000000)
         {
             last = Times.now();    
-            printf("ELAPSED TIME %10lld us\n",time_us_64());
+            uint64_t now_us = time_us_64();
+            printf("ELAPSED TIME %10lld us\n",(long long)now_us);
             Times.text(15, str);
             printf("PACKET TIMES\n%s\n", str);
             Sizes.text(15, str);
             printf("PACKET SIZES\n%s\n", str);
+            printf("RTP TX        sent %8lu  overruns %6lu  timeouts %6lu\n",
+                   (unsigned long)rtp_tx.sent, (unsigned long)rtp_tx.overruns, (unsigned long)rtp_tx.timeouts);
+            flows_text(str, now_us - last_us);
+            printf("%s\n", str);
+            if (latency.found)
+            {
+                latency_text(latency, str, sizeof(str));
+                printf("%s", str);
+                Lat.text(15, str);
+                printf("LATENCY\n%s\n", str);
+            }
+            last_us = now_us;
             Times.reset();
             Sizes.reset();
         }
@@ -4,6 +4,8 @@
 // The input should already be scaled down by 8 bits for the math and headroom
 // The filter uses effective 6 bit coefficients
 // Allow the output to be written in interleaved format
+// Returns the number of output samples that had to be saturated, for the metering
+// Runs from RAM, as it is called from the ISR and must not stall on flash
 // 
 // W = 2*fir1(63, 0.4751, 'low', kbdwin(64, 5), 'noscale');
 // W = filter(1.3,[1 0 .3],W);
@@ -16,10 +18,12 @@
 //
 
 #define FILTER2X_TAPS 21
+#define FILTER2X_DELAY 9.5f       // DC group delay in input frames, 9.59 and 8.91 plus the half frame for the phases
 #define TAP(a, b, n)  { z1 += a * *(p+20-n); z2 += b * *(p+20-n); }
 
-void filter2x(int32_t *in, int32_t *out, int n, int out_stride = 1)
+int __not_in_flash_func(filter2x)(int32_t *in, int32_t *out, int n, int out_stride = 1)
 {
+    int clips = 0;
     int32_t *p = in - 20;                       // Index from oldest sample, since M0+ only has positive load offset
     for (int i = 0; i < n; i++)                 // This gives us a 20% speedup saving one instruction per TAP
     {
@@ -47,16 +51,17 @@ void filter2x(int32_t *in, int32_t *out, int n, int out_stride = 1)
         TAP(   1,  -1, 19);
         TAP(  -1,   0, 20);
 
-        if (z1 >  0x0FFFFFFF) z1 =  0x0FFFFFFF;
-        if (z1 < -0x10000000) z1 = -0x10000000; 
+        if (z1 >  0x0FFFFFFF) { z1 =  0x0FFFFFFF; clips++; }
+        if (z1 < -0x10000000) { z1 = -0x10000000; clips++; }
         *out = z1<<3;
         out += out_stride;
 
-        if (z2 >  0x0FFFFFFF) z2 =  0x0FFFFFFF;
-        if (z2 < -0x10000000) z2 = -0x10000000;
+        if (z2 >  0x0FFFFFFF) { z2 =  0x0FFFFFFF; clips++; }
+        if (z2 < -0x10000000) { z2 = -0x10000000; clips++; }
         *out = z2<<3;
         out += out_stride;
         p++;
     }
+    return clips;
 }
 